@@ -0,0 +1,102 @@
+#include <smf_parser.h>
+#include <edge_hash.h>
+#include <map>
+#include <chrono>
+#include <cstdio>
+
+using std::map;
+
+// Edge key of the std::map edge index that EdgeHash replaced, "v1|v2" with v1 < v2
+static string getStringEdgeKey (int v1, int v2) {
+	if (v1 < v2)
+		return to_string(v1) + "|" + to_string(v2);
+	else
+		return to_string(v2) + "|" + to_string(v1);
+}
+
+// Seconds on a steady clock
+static double getTime () {
+	return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Replay the edge lookups of building a mesh from its faces, inserting each edge when it is first
+// seen, then look every edge up once more as subdivision does; returns the sum of the values found
+static long runStringMap (const vector<int> &indices) {
+	map<string, int> edges;
+	long sum = 0;
+	int numEdges = 0;
+
+	for (size_t i = 0; i < indices.size(); i++) {
+		int v1 = indices[i], v2 = indices[i - i % 3 + (i + 1) % 3];
+		map<string, int>::iterator it = edges.find(getStringEdgeKey(v1, v2));
+
+		if (it == edges.end())
+			edges.insert(std::make_pair(getStringEdgeKey(v1, v2), ++numEdges));
+		else
+			sum += it->second;
+	}
+
+	for (size_t i = 0; i < indices.size(); i++) {
+		sum += edges.find(getStringEdgeKey(indices[i], indices[i - i % 3 + (i + 1) % 3]))->second;
+	}
+
+	return sum;
+}
+
+// The same lookups on an EdgeHash reserved from the face count, as the SMF header allows
+static long runEdgeHash (const vector<int> &indices) {
+	EdgeHash<int> edges;
+	edges.reserve(indices.size() / 2);
+	long sum = 0;
+	int numEdges = 0;
+
+	for (size_t i = 0; i < indices.size(); i++) {
+		uint64_t key = getEdgeKey(indices[i], indices[i - i % 3 + (i + 1) % 3]);
+		int *edge = edges.find(key);
+
+		if (edge == NULL)
+			edges.insert(key, ++numEdges);
+		else
+			sum += *edge;
+	}
+
+	for (size_t i = 0; i < indices.size(); i++) {
+		sum += *edges.find(getEdgeKey(indices[i], indices[i - i % 3 + (i + 1) % 3]));
+	}
+
+	return sum;
+}
+
+// Time the edge index of std::map<string> against EdgeHash on the faces of an SMF file
+int main (int argc, char **argv) {
+	string filename = (argc > 1) ? argv[1] : "samples/horse.smf";
+	int numRuns = (argc > 2) ? atoi(argv[2]) : 3;
+
+	Mesh *mesh = parseSmfFile(filename);
+	vector<int> indices(3 * mesh->numFaces);
+
+	for (int f = 1; f <= mesh->numFaces; f++) {
+		mesh->getAllVerticesForFace(f, &indices[3 * f - 3]);
+	}
+
+	delete mesh;
+
+	printf("%s: %d edge lookups\n", filename.c_str(), (int) (2 * indices.size()));
+
+	for (int run = 0; run < numRuns; run++) {
+		double start = getTime();
+		long mapSum = runStringMap(indices);
+		double middle = getTime();
+		long hashSum = runEdgeHash(indices);
+		double end = getTime();
+
+		if (mapSum != hashSum) {
+			cerr << "Edge indices differ." << endl;
+			return 1;
+		}
+
+		printf("map<string> %8.2f ms   EdgeHash %8.2f ms   %.1fx\n", (middle - start) * 1e3, (end - middle) * 1e3, (middle - start) / (end - middle));
+	}
+
+	return 0;
+}
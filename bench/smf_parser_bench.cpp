@@ -0,0 +1,146 @@
+#include <smf_parser.h>
+#include <chrono>
+#include <cstdio>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// Seconds on a steady clock
+static double getTime () {
+	return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Read the records of an SMF file with ifstream extraction, as parseSmfFile did before it mapped
+// the file
+static void readWithStream (string filename, vector<vec3> &positions, vector<int> &indices) {
+	ifstream smf_file(filename.c_str());
+	char type;
+	string line;
+
+	while (smf_file >> type) {
+		float x, y, z;
+		int v1, v2, v3;
+
+		switch (type) {
+			case '#':
+				getline(smf_file, line);
+				break;
+			case 'v':
+				smf_file >> x >> y >> z;
+				positions.push_back(vec3(x, y, z));
+				break;
+			case 'f':
+				smf_file >> v1 >> v2 >> v3;
+				indices.push_back(v1);
+				indices.push_back(v2);
+				indices.push_back(v3);
+				break;
+		}
+	}
+}
+
+// Map an SMF file and scan its records with parseSmfRecords, on one thread or on all of them
+static void readWithMap (string filename, bool isParallel, vector<vec3> &positions, vector<int> &indices) {
+	int fd = open(filename.c_str(), O_RDONLY);
+	struct stat fileStat;
+	fstat(fd, &fileStat);
+
+	size_t size = fileStat.st_size;
+	const char *data = (const char *) mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	madvise((void *) data, size, MADV_SEQUENTIAL);
+
+	int numVertices, numFaces;
+	readSmfHeader(data, data + size, numVertices, numFaces);
+	positions.reserve(numVertices);
+	indices.reserve(3 * numFaces);
+
+	if (isParallel)
+		parseSmfRecordsParallel(data, data + size, positions, indices);
+	else
+		parseSmfRecords(data, data + size, positions, indices);
+
+	munmap((void *) data, size);
+	close(fd);
+}
+
+// Write copies of a mesh side by side into one SMF file, to benchmark files of any size
+static void generateSmfFile (string filename, int numCopies, string outputFilename) {
+	Mesh *mesh = parseSmfFile(filename);
+	mesh->computeBoundingBox();
+
+	Mesh *copies = new Mesh();
+	int numVertices = mesh->numVertices;
+	vector<vec3> positions(1);
+	vector<int> indices;
+	positions.reserve((size_t) numCopies * numVertices + 1);
+	indices.reserve((size_t) numCopies * 3 * mesh->numFaces);
+
+	for (int c = 0; c < numCopies; c++) {
+		vec3 offset((mesh->xMax - mesh->xMin) * 1.1f * c, 0.0f, 0.0f);
+
+		for (int v = 1; v <= numVertices; v++)
+			positions.push_back(mesh->positions[v] + offset);
+
+		for (int f = 1; f <= mesh->numFaces; f++) {
+			int vertices[3];
+			mesh->getAllVerticesForFace(f, vertices);
+			for (int j = 0; j < 3; j++)
+				indices.push_back(vertices[j] + c * numVertices);
+		}
+	}
+
+	delete mesh;
+
+	copies->buildFromIndexedTriangles(positions, indices);
+	writeSmfFile(copies, outputFilename);
+	delete copies;
+}
+
+// Report the throughput of the SMF readers on a file in MB/s
+// With -g <copies> <output>, first write that many copies of the file into output and measure it.
+int main (int argc, char **argv) {
+	string filename = (argc > 1) ? argv[1] : "samples/horse.smf";
+
+	if (argc > 4 && string(argv[2]) == "-g") {
+		generateSmfFile(filename, atoi(argv[3]), argv[4]);
+		filename = argv[4];
+	}
+
+	struct stat fileStat;
+	if (stat(filename.c_str(), &fileStat) != 0) {
+		cerr << "Error opening file." << endl;
+		return 1;
+	}
+
+	double megabytes = fileStat.st_size / 1e6;
+	printf("%s: %.1f MB\n", filename.c_str(), megabytes);
+
+	const char *names[3] = {"ifstream", "mmap", "mmap, all threads"};
+	size_t numVertices = 0, numIndices = 0;
+
+	for (int reader = 0; reader < 3; reader++) {
+		vector<vec3> positions;
+		vector<int> indices;
+
+		double start = getTime();
+		if (reader == 0)
+			readWithStream(filename, positions, indices);
+		else
+			readWithMap(filename, reader == 2, positions, indices);
+		double seconds = getTime() - start;
+
+		// Every reader must find the same records
+		if (reader > 0 && (positions.size() != numVertices || indices.size() != numIndices)) {
+			cerr << "Readers found different records." << endl;
+			return 1;
+		}
+
+		numVertices = positions.size();
+		numIndices = indices.size();
+
+		printf("%-18s %8.3f s %8.1f MB/s\n", names[reader], seconds, megabytes / seconds);
+	}
+
+	return 0;
+}
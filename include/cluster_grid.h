@@ -0,0 +1,53 @@
+#ifndef CLUSTER_GRID_H
+#define CLUSTER_GRID_H
+
+#include <cstdint>
+#include <algorithm>
+#include <glm/glm.hpp>
+#include <quadric.h>
+
+using glm::vec3;
+
+// Cluster Grid
+// Uniform grid of cubic cells for vertex clustering, with size cells along the longest side of a
+// bounding box. A cell is keyed by its coordinates packed into 21 bits each, plus one so that no
+// key is zero and keys can go straight into an EdgeHash.
+struct ClusterGrid {
+	vec3 origin;
+	float cellSize;
+	int size;
+
+	ClusterGrid (vec3 minimum, vec3 maximum, int size) : origin(minimum) {
+		this->size = std::max(1, std::min(size, 1 << 20));
+
+		vec3 extent = maximum - minimum;
+		float longest = std::max(extent.x, std::max(extent.y, extent.z));
+		cellSize = (longest > 0.0f) ? longest / this->size : 1.0f;
+	};
+
+	// Key of the cell holding a point of the bounding box
+	uint64_t getCell (vec3 p) const {
+		vec3 cell = (p - origin) / cellSize;
+		uint64_t x = std::min((int) cell.x, size - 1);
+		uint64_t y = std::min((int) cell.y, size - 1);
+		uint64_t z = std::min((int) cell.z, size - 1);
+
+		return (x << 42 | y << 21 | z) + 1;
+	};
+
+	// Place the cluster of a cell at the minimum of the summed quadric of its vertices
+	// Falls back to the mean of the vertices if the quadric is singular or its minimum is outside the cell.
+	vec3 getClusterPosition (uint64_t cell, const Quadric &quadric, vec3 mean) const {
+		uint64_t key = cell - 1;
+		vec3 cellMin = origin + vec3(key >> 42, (key >> 21) & 0x1FFFFF, key & 0x1FFFFF) * cellSize;
+		vec3 cellMax = cellMin + vec3(cellSize);
+
+		vec3 position;
+		if (quadric.optimize(position) && glm::all(glm::greaterThanEqual(position, cellMin)) && glm::all(glm::lessThanEqual(position, cellMax)))
+			return position;
+
+		return mean;
+	};
+};
+
+#endif
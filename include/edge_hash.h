@@ -0,0 +1,178 @@
+#ifndef EDGE_HASH_H
+#define EDGE_HASH_H
+
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+
+using std::vector;
+
+// Pack the edge between vertices v1 and v2 into a single key, independent of direction
+inline uint64_t getEdgeKey (int v1, int v2) {
+	if (v1 < v2)
+		return ((uint64_t) v1 << 32) | (uint32_t) v2;
+	else
+		return ((uint64_t) v2 << 32) | (uint32_t) v1;
+}
+
+// Edge Hash
+// Flat open addressing table (linear probing) from a packed vertex pair to a value.
+// Vertex indices start at 1, so a zero key marks an empty slot.
+template <typename T>
+struct EdgeHash {
+	vector<uint64_t> keys;
+	vector<T> values;
+	uint64_t mask;
+	int count;
+
+	EdgeHash () : mask(0), count(0) {};
+
+	int size () { return count; };
+
+	void reserve (int n);
+
+	void clear ();
+
+	T *find (uint64_t key);
+
+	void insert (uint64_t key, T value);
+
+	void insertAll (int n, const uint64_t *newKeys, const T *newValues);
+
+	void erase (uint64_t key);
+
+	uint64_t getSlot (uint64_t key);
+
+	void rehash (uint64_t capacity);
+};
+
+// Home slot for a key
+template <typename T>
+uint64_t EdgeHash<T>::getSlot (uint64_t key) {
+	uint64_t h = key * 0x9E3779B97F4A7C15ULL;
+	return (h ^ (h >> 32)) & mask;
+}
+
+// Grow the table to hold at least n entries at a load factor of one half
+template <typename T>
+void EdgeHash<T>::reserve (int n) {
+	uint64_t capacity = 16;
+	while (capacity < (uint64_t) n * 2)
+		capacity <<= 1;
+
+	if (capacity > keys.size())
+		rehash(capacity);
+}
+
+// Remove all entries, keeping the allocated table
+template <typename T>
+void EdgeHash<T>::clear () {
+	std::fill(keys.begin(), keys.end(), 0);
+	count = 0;
+}
+
+// Move all entries into a table of the given power of two capacity
+template <typename T>
+void EdgeHash<T>::rehash (uint64_t capacity) {
+	vector<uint64_t> oldKeys(capacity, 0);
+	vector<T> oldValues(capacity);
+	oldKeys.swap(keys);
+	oldValues.swap(values);
+
+	mask = capacity - 1;
+	count = 0;
+
+	for (size_t i = 0; i < oldKeys.size(); i++) {
+		if (oldKeys[i] != 0)
+			insert(oldKeys[i], oldValues[i]);
+	}
+}
+
+// Fetch the value stored for a key, NULL if the key is absent
+template <typename T>
+T *EdgeHash<T>::find (uint64_t key) {
+	if (count == 0)
+		return NULL;
+
+	for (uint64_t i = getSlot(key); keys[i] != 0; i = (i + 1) & mask) {
+		if (keys[i] == key)
+			return &values[i];
+	}
+
+	return NULL;
+}
+
+// Insert a value for a key, replacing any existing value
+template <typename T>
+void EdgeHash<T>::insert (uint64_t key, T value) {
+	if ((uint64_t) (count + 1) * 2 > keys.size())
+		rehash(keys.empty() ? 16 : keys.size() * 2);
+
+	uint64_t i = getSlot(key);
+	while (keys[i] != 0 && keys[i] != key)
+		i = (i + 1) & mask;
+
+	if (keys[i] == 0)
+		count++;
+
+	keys[i] = key;
+	values[i] = value;
+}
+
+// Insert n distinct keys that are not in the table yet, in parallel
+// Threads claim empty slots with a compare-and-swap on the key
+template <typename T>
+void EdgeHash<T>::insertAll (int n, const uint64_t *newKeys, const T *newValues) {
+	reserve(count + n);
+
+	#pragma omp parallel for
+	for (int i = 0; i < n; i++) {
+		uint64_t slot = getSlot(newKeys[i]);
+
+		while (true) {
+			uint64_t empty = 0;
+			if (__atomic_compare_exchange_n(&keys[slot], &empty, newKeys[i], false, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+				break;
+			slot = (slot + 1) & mask;
+		}
+
+		values[slot] = newValues[i];
+	}
+
+	count += n;
+}
+
+// Erase a key, shifting the following entries of its probe run back into the gap
+template <typename T>
+void EdgeHash<T>::erase (uint64_t key) {
+	if (count == 0)
+		return;
+
+	uint64_t i = getSlot(key);
+	while (keys[i] != key) {
+		if (keys[i] == 0)
+			return;
+		i = (i + 1) & mask;
+	}
+
+	uint64_t j = i;
+	while (true) {
+		j = (j + 1) & mask;
+		if (keys[j] == 0)
+			break;
+
+		// An entry may fill the gap only if its home slot does not lie cyclically in (i, j]
+		uint64_t home = getSlot(keys[j]);
+		if ((i <= j) ? (i < home && home <= j) : (i < home || home <= j))
+			continue;
+
+		keys[i] = keys[j];
+		values[i] = values[j];
+		i = j;
+	}
+
+	keys[i] = 0;
+	count--;
+}
+
+#endif
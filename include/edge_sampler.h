@@ -0,0 +1,92 @@
+#ifndef EDGE_SAMPLER_H
+#define EDGE_SAMPLER_H
+
+#include <vector>
+#include <random>
+
+using std::vector;
+
+// Edge Sampler
+// Draws edges uniformly at random from the edges that are not flagged. The unflagged edges are
+// kept densely in eligible[0..count) and every edge knows its place there, so flagging an edge
+// swaps it behind the eligible ones in O(1). One generator is kept for all draws, so seeding it
+// makes a whole decimation reproducible.
+struct EdgeSampler {
+	std::mt19937 generator;
+	vector<int> eligible;
+	vector<int> position;
+	int count;
+
+	EdgeSampler () : generator(std::random_device()()), count(0) {};
+
+	void seed (unsigned int value) { generator.seed(value); };
+
+	int size () { return count; };
+
+	void reset (int numEdges);
+
+	int sample ();
+
+	bool isFlagged (int edge) { return position[edge] >= count; };
+
+	void flag (int edge);
+
+	void unflagAll ();
+
+	void resize (int numEdges);
+
+	void swap (int i, int j);
+};
+
+// Make edges 1..numEdges eligible
+inline void EdgeSampler::reset (int numEdges) {
+	eligible.resize(numEdges);
+	position.resize(numEdges + 1);
+
+	for (int i = 0; i < numEdges; i++) {
+		eligible[i] = i + 1;
+		position[i + 1] = i;
+	}
+
+	count = numEdges;
+}
+
+// Draw an eligible edge, there must be at least one
+inline int EdgeSampler::sample () {
+	std::uniform_int_distribution<int> distribution(0, count - 1);
+	return eligible[distribution(generator)];
+}
+
+// Exchange the edges at places i and j
+inline void EdgeSampler::swap (int i, int j) {
+	int a = eligible[i], b = eligible[j];
+	eligible[i] = b;
+	eligible[j] = a;
+	position[b] = i;
+	position[a] = j;
+}
+
+// Stop drawing an edge until the flags are cleared
+inline void EdgeSampler::flag (int edge) {
+	if (!isFlagged(edge))
+		swap(position[edge], --count);
+}
+
+// Make all flagged edges eligible again
+inline void EdgeSampler::unflagAll () {
+	count = eligible.size();
+}
+
+// Drop the edges above numEdges, after an edge collapse deleted the last edges
+inline void EdgeSampler::resize (int numEdges) {
+	unflagAll();
+
+	for (int edge = eligible.size(); edge > numEdges; edge--) {
+		swap(position[edge], --count);
+	}
+
+	eligible.resize(count);
+	position.resize(numEdges + 1);
+}
+
+#endif
@@ -1,18 +1,26 @@
 #ifndef MESH_H
 #define MESH_H
 
-#include <map>
 #include <string>
+#include <vector>
+#include <functional>
 #include <glm/glm.hpp>
-#include <random>
+#include <edge_hash.h>
+#include <quadric.h>
+#include <edge_sampler.h>
 
 #define PI 3.14159265
 
+// Largest vertex valence handled by the edge collapse checks
+#define MAX_RING_SIZE 64
+
+// Largest vertex valence with precomputed subdivision weights, higher ones compute them as needed
+#define MAX_WEIGHT_VALENCE 32
+
 using std::string;
 using std::to_string;
 
-using std::map;
-using std::make_pair;
+using std::vector;
 
 using glm::vec3;
 using glm::vec4;
@@ -20,123 +28,239 @@ using glm::normalize;
 using glm::cross;
 using glm::dot;
 
-using glm::mat4;
-using glm::outerProduct;
 
 // Subdivision Types
 enum SubdivisionType {BUTTERFLY, LOOP};
 
-// Winged Edge
-struct W_edge {
-	struct Vertex *start, *end;
-	struct Face *left, *right;
-	struct W_edge *left_prev, *left_next;
-	struct W_edge *right_prev, *right_next;
-
-	W_edge (Vertex *start, Vertex *end) : start(start), end(end) {};
-	
-	W_edge (Vertex *start, Vertex *end, Face *left) : start(start), end(end), left(left) {};
+// Decimation Types
+enum DecimationType {MULTIPLE_CHOICE, GREEDY, PARALLEL, CLUSTERING};
+
+// Edge Collapse Types: where the remaining vertex of a collapse goes
+// A half edge collapse keeps the end point of least error where it is, so every decimated mesh
+// uses a subset of the original vertex positions. A memoryless collapse scores and places the
+// vertex from the faces around the edge as they are now, not from the quadrics summed since the
+// mesh was built.
+enum CollapseType {OPTIMAL_COLLAPSE, HALF_EDGE_COLLAPSE, MEMORYLESS_COLLAPSE};
+
+// Level of Detail
+// Limits at which a decimation stops, whichever is reached first
+struct LodLevel {
+	int targetFaces;
+	float maxError;
 };
 
-// Vertex
-struct Vertex {
-	vec3 position;
-	vec3 normal;
-	mat4 quadric;
-
-	struct W_edge *edge;
-	
-	Vertex (float x, float y, float z);
-	Vertex (vec3 position);
+// Edge Collapse Record
+// An edge collapse by the vertex indices just before it: the remaining and the removed vertex,
+// the vertices opposite the edge in its left and right faces, and where both end points were.
+// Enough to split the remaining vertex again.
+struct CollapseRecord {
+	int vertex, removedVertex;
+	int left, right;
+	vec3 position, removedPosition;
 };
 
-// Face
-struct Face {
-	struct W_edge *edge;
-	
-	Face (W_edge *edge) : edge(edge) {};
+// Edge Collapse Inverse
+// Everything an edge collapse overwrites, so that undoCollapse can restore the mesh exactly: the
+// deleted edges and the edges rewired around them (start, end, left, right and the four links),
+// the deleted faces and the faces beyond them, and both end points as they were (the remaining
+// vertex, the removed one and the two vertices opposite the edge). The edge is kept to redo it.
+struct CollapseInverse {
+	int edge;
+	int edges[9];
+	int edgeLinks[9][8];
+	int faces[4], faceEdges[4];
+	vec3 faceNormals[2];
+	int vertices[4], vertexEdges[4];
+	vec3 positions[2], removedNormal;
+	Quadric quadrics[2];
 };
 
 // Mesh
+// Vertices, winged edges and faces are stored as arrays addressed by indices starting at 1.
+// Index 0 is the null element, so a 0 link means "no vertex/edge/face".
+// Deleting swaps the last element into the freed slot, so the arrays stay dense and the
+// capacity released by an edge collapse is reused by the next insert without allocating.
 struct Mesh {
 	int numVertices, numEdges, numFaces;
-	map<string, W_edge*> edgeMap;
-	map<int, string> edgeKeyMap;
-	map<W_edge*, int> edgeIndexMap;
-	map<int, Vertex*> vertexMap;
-	map<int, Face*> faceMap;
-	map<Vertex*, int> vertexIndexMap;
-	map<Face*, int> faceIndexMap;
-	map<string, vec3> faceNormalMap;
+
+	// Vertices
+	vector<vec3> positions;
+	vector<vec3> normals;
+	vector<Quadric> quadrics; // Empty unless hasQuadrics is set
+	vector<int> vertexEdge;
+	vector<int> valences; // Number of edges at each vertex, kept up to date by every edit
+
+	// Winged Edges
+	vector<int> edgeStart, edgeEnd;
+	vector<int> edgeLeft, edgeRight;
+	vector<int> edgeLeftPrev, edgeLeftNext;
+	vector<int> edgeRightPrev, edgeRightNext;
+
+	// Faces
+	vector<int> faceEdge;
+	vector<vec3> faceNormals;
+
+	EdgeHash<int> edgeMap;
+	EdgeSampler sampler;
+	int collapseType;
+
+	// Whether each vertex keeps the sum of the quadrics of its faces; without them, every collapse
+	// is scored from the faces around it as a memoryless one
+	bool hasQuadrics;
+
+	// Generation-stamped vertex marks for the edge collapse checks
+	vector<unsigned int> vertexMarks;
+	unsigned int vertexMark;
+
+	// Candidate edges of the multiple choice decimation with their collapses, reused by every draw
+	vector<int> candidateEdges;
+	vector<vec3> candidatePositions;
+	vector<float> candidateErrors;
+
+	// Edge collapses since the mesh was built, kept only while recordCollapses is set
+	bool recordCollapses;
+	vector<CollapseRecord> collapseRecords;
+
+	// Inverses of the edge collapses since the mesh was built, kept only while recordInverses is set
+	bool recordInverses;
+	vector<CollapseInverse> collapseInverses;
 	float xMin, yMin, zMin, xMax, yMax, zMax;
 
-	Mesh () {};
+	Mesh ();
+
+	Mesh (int numVertices, int numFaces);
 
-	Mesh (int numVertices, int numFaces) : numVertices(numVertices), numFaces(numFaces) {};
+	void reserve (int numVertices, int numEdges, int numFaces);
 
-	Vertex *insertVertex (float x, float y, float z);
+	void resize (int numVertices, int numEdges, int numFaces);
 
-	Vertex *insertVertex (Vertex *vertex);
+	int insertVertex (float x, float y, float z);
 
-	void deleteVertex (Vertex *vertex);
+	int insertVertex (vec3 position);
 
-	W_edge *insertEdge (int v1, int v2);
+	void moveVertex (int from, int to);
 
-	void deleteEdge (W_edge *edge);
+	void deleteVertex (int vertex);
 
-	Face *insertFace (W_edge *edge);
+	int insertEdge (int v1, int v2);
 
-	void deleteFace (Face *face);
+	void moveEdge (int from, int to);
+
+	void deleteEdge (int edge);
+
+	int insertFace (int edge);
+
+	void moveFace (int from, int to);
+
+	void deleteFace (int face);
 
 	void insertTriangle (int v1, int v2, int v3);
 
-	void insertFaceNormal (Face *f, int v1, int v2, int v3);
+	void buildFromIndexedTriangles (const vector<vec3> &vertexPositions, const vector<int> &indices);
+
+	void buildFromClusteredTriangles (vector<vec3> &vertexPositions, vector<int> &indices);
 
-	void updateVertexNormalForVertex (Face *f, int v1);
+	void insertFaceNormal (int f, int v1, int v2, int v3);
 
-	void updateVertexNormalForEachVertex (Face *f, int v1, int v2, int v3);
+	void updateVertexNormalForVertex (int f, int v1);
 
-	W_edge *getEdge (int v1, int v2);
-	
-	vec3 getFaceNormal (Face *f);
+	void updateVertexNormalForEachVertex (int f, int v1, int v2, int v3);
 
-	void getAllEdgesForFace (Face *f, W_edge *edges[3]);
+	int getEdge (int v1, int v2);
 
-	void getAllVerticesForFace (Face *f, Vertex *vertices[3]);
+	vec3 getFaceNormal (int f);
+
+	void getAllEdgesForFace (int f, int edges[3]);
+
+	void getAllVerticesForFace (int f, int vertices[3]);
+
+	int getNextVertex (int edge, int nextEdge);
+
+	int getOtherVertex (int edge, int vertex);
+
+	int getDegreeOfVertex (int vertex);
+
+	void computeValences ();
+
+	int getRing (int vertex, int *ring, int maxSize);
 
 	void computeBoundingBox ();
 
 	// Subdivision
+	vec3 computeMidpoint (int edge);
+
+	vec3 computeNewVertex (int vertex);
+
+	void splitFaces (Mesh *subdividedMesh);
+
 	Mesh *loopSubdivision ();
 
+	bool isRegular (int vertex);
+
+	vec3 computeNewVertexAroundIrregularVertex (int edge, int vertex);
+
+	int getButterflyVertex (int edge, int nextEdge);
+
+	void getButterflyVertices (int edge, int vertices[4]);
+
+	vec3 computeMidpointButterfly (int edge);
+
 	Mesh *butterflySubdivision ();
 
 	Mesh *subdivideMesh (int subdivisionType, int subdivisionLevel);
 
+	void getVertexStencil (int subdivisionType, int vertex, vector<int> &vertices, vector<float> &weights);
+
+	void getMidpointStencil (int subdivisionType, int edge, vector<int> &vertices, vector<float> &weights);
+
 	// Decimation
-	mat4 getQuadric (Face *f, Vertex *v);
+	Quadric getQuadric (int f, int v);
+
+	void updateQuadricForVertex (int f, int v1);
+
+	void updateQuadricForEachVertex (int f, int v1, int v2, int v3);
+
+	Quadric getVertexQuadric (int v);
 
-	void updateQuadricForVertex (Face *f, int v1);
+	bool usesLocalCosts ();
 
-	void updateQuadricForEachVertex (Face *f, int v1, int v2, int v3);
+	vec3 computeNewVertexPositionForEdgeCollapse(int edge);
 
-	vec4 computeNewVertexPositionForEdgeCollapse(W_edge *edge);
+	float getError (int edge, vec3 p);
 
-	W_edge *getCandidateEdgeToCollapse (int k, map<W_edge*, bool> flagged);
+	void evaluateEdgeCollapses (int n, const int *edges, vec3 *newPositions, float *errors);
 
-	bool canCauseFoldOver (W_edge *edge);
-	
-	bool canCauseNonManifoldMesh (W_edge *edge);
+	void seedDecimation (unsigned int seed);
 
-	void collapseEdge (W_edge *edge);
+	int getCandidateEdgeToCollapse (int k);
+
+	bool canCauseFoldOver (int edge);
+
+	bool canCauseNonManifoldMesh (int edge);
+
+	bool canCollapseEdge (int edge);
+
+	void relinkEdgeCollapse (int edge, vec3 newVertexPosition, bool updateEdgeMap);
+
+	void collapseEdge (int edge);
+
+	void undoCollapse (const CollapseInverse &inverse);
 
 	void decimate (int k, int n);
+
+	void greedyDecimation (int targetFaces, float maxError);
+
+	void decimateToLevels (const vector<LodLevel> &levels, const std::function<void (int)> &snapshot);
+
+	void parallelDecimation (int targetFaces, float maxError);
+
+	void clusterDecimation (int gridSize);
 };
 
-string getEdgeKey (int v1, int v2);
+vec3 getFaceNormalVector (vec3 p1, vec3 p2, vec3 p3);
 
-vec3 getFaceNormalVector (Vertex *v1, Vertex *v2, Vertex *v3);
+float computeBeta (int k);
 
-Vertex *getNextVertex (W_edge *edge, W_edge *next_edge);
+float computeButterflyWeight (int k, int j);
 
 #endif
\ No newline at end of file
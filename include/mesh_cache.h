@@ -0,0 +1,45 @@
+#ifndef MESH_CACHE_H
+#define MESH_CACHE_H
+
+#include <mesh.h>
+#include <cstdint>
+
+#define MESH_CACHE_MAGIC 0x4853454d // "MESH"
+#define MESH_CACHE_VERSION 1
+#define MESH_CACHE_ALIGNMENT 64
+
+// Optional sections of a mesh cache
+enum MeshCacheFlags {CACHE_NORMALS = 1, CACHE_QUADRICS = 2};
+
+// Sections of a mesh cache, in file order
+enum MeshCacheSection {
+	SECTION_POSITIONS, SECTION_NORMALS, SECTION_QUADRICS, SECTION_VERTEX_EDGE,
+	SECTION_EDGE_START, SECTION_EDGE_END, SECTION_EDGE_LEFT, SECTION_EDGE_RIGHT,
+	SECTION_EDGE_LEFT_PREV, SECTION_EDGE_LEFT_NEXT, SECTION_EDGE_RIGHT_PREV, SECTION_EDGE_RIGHT_NEXT,
+	SECTION_FACE_EDGE, SECTION_FACE_NORMALS, SECTION_EDGE_MAP_KEYS, SECTION_EDGE_MAP_VALUES,
+	NUM_SECTIONS
+};
+
+// Mesh Cache Header
+// A mesh cache is this header followed by the mesh arrays, each starting at a multiple of
+// MESH_CACHE_ALIGNMENT bytes, so that the arrays are copied in bulk without any parsing.
+// The size and modification time of the SMF file the mesh was read from identify stale caches.
+struct MeshCacheHeader {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t flags;
+	uint32_t edgeMapCount;
+	int32_t numVertices, numEdges, numFaces;
+	uint32_t padding;
+	uint64_t edgeMapCapacity;
+	uint64_t sourceSize;
+	int64_t sourceModified;
+	uint64_t sectionOffsets[NUM_SECTIONS];
+	uint64_t sectionSizes[NUM_SECTIONS];
+};
+
+string getMeshCacheFilename(string smfFilename);
+bool writeMeshCache(Mesh *mesh, string filename, string sourceFilename = "", int flags = CACHE_NORMALS | CACHE_QUADRICS);
+Mesh *readMeshCache(string filename, string sourceFilename = "", bool hasQuadrics = true);
+
+#endif
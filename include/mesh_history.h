@@ -0,0 +1,53 @@
+#ifndef MESH_HISTORY_H
+#define MESH_HISTORY_H
+
+#include <mesh.h>
+#include <deque>
+
+// Default memory cap of the undo history, in megabytes
+#define DEFAULT_HISTORY_BUDGET 512
+
+// Mesh History Entry
+// A decimation keeps the inverses of its edge collapses and their collapse type, and mesh is
+// NULL. An edit that replaces or rebuilds the mesh keeps the other mesh: the one before the edit
+// while the entry can be undone, the one after it while the entry can be redone.
+struct MeshHistoryEntry {
+	vector<CollapseInverse> inverses;
+	int collapseType;
+	Mesh *mesh;
+	size_t numBytes;
+};
+
+// Mesh History
+// Undo and redo stacks for the edits of the viewer. A decimation is undone in place from the
+// inverses of its collapses, newest first, and redone by collapsing the same edges again, which
+// gives the same mesh. Undoing or redoing a replaced mesh swaps it with the current one. The
+// entries take at most maxBytes, dropping the oldest undo entries first and then the redo entries
+// furthest ahead.
+struct MeshHistory {
+	std::deque<MeshHistoryEntry> undoEntries;
+	vector<MeshHistoryEntry> redoEntries;
+	size_t maxBytes, numBytes;
+
+	MeshHistory () : maxBytes((size_t) DEFAULT_HISTORY_BUDGET << 20), numBytes(0) {};
+
+	~MeshHistory () { clear(); };
+
+	void clear ();
+
+	void beginDecimation (Mesh *mesh);
+
+	void endDecimation (Mesh *mesh);
+
+	void pushMesh (Mesh *previousMesh);
+
+	bool undo (Mesh *&mesh);
+
+	bool redo (Mesh *&mesh);
+
+	void trim ();
+
+	void push (MeshHistoryEntry &entry);
+};
+
+#endif
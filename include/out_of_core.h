@@ -0,0 +1,15 @@
+#ifndef OUT_OF_CORE_H
+#define OUT_OF_CORE_H
+
+#include <mesh.h>
+#include <cstddef>
+
+// Default memory budget of the out-of-core decimation, in megabytes
+#define DEFAULT_MEMORY_BUDGET 256
+
+// Size of the blocks an SMF file is streamed in, in bytes
+#define SMF_STREAM_BLOCK_SIZE (8 << 20)
+
+Mesh *decimateSmfFileOutOfCore (string filename, int &gridSize, size_t memoryBudget);
+
+#endif
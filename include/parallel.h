@@ -0,0 +1,73 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <vector>
+#include <algorithm>
+
+#ifdef _OPENMP
+#include <omp.h>
+#else
+inline int omp_get_max_threads () { return 1; }
+inline int omp_get_thread_num () { return 0; }
+#endif
+
+// Replace values[0..n) by their inclusive prefix sums
+// Each thread scans one block, then adds the total of the blocks before it
+template <typename T>
+void parallelPrefixSum (T *values, int n) {
+	int numThreads = omp_get_max_threads();
+	std::vector<T> blockSums(numThreads + 1, 0);
+
+	#pragma omp parallel num_threads(numThreads)
+	{
+		int t = omp_get_thread_num();
+		int begin = (long long) n * t / numThreads;
+		int end = (long long) n * (t + 1) / numThreads;
+
+		T sum = 0;
+		for (int i = begin; i < end; i++) {
+			sum += values[i];
+			values[i] = sum;
+		}
+		blockSums[t + 1] = sum;
+
+		#pragma omp barrier
+		#pragma omp single
+		for (int i = 1; i <= numThreads; i++)
+			blockSums[i] += blockSums[i - 1];
+
+		T offset = blockSums[t];
+		for (int i = begin; i < end; i++)
+			values[i] += offset;
+	}
+}
+
+// Group the items 0..n) by key(i), a value in 0..numKeys), with a counting sort
+// Group k is items[offsets[k]..offsets[k + 1]), in increasing item order
+template <typename KeyFunction>
+void parallelGroupBy (int n, int numKeys, KeyFunction key, std::vector<int> &offsets, std::vector<int> &items) {
+	offsets.assign(numKeys + 1, 0);
+	items.resize(n);
+
+	#pragma omp parallel for
+	for (int i = 0; i < n; i++) {
+		__atomic_fetch_add(&offsets[key(i) + 1], 1, __ATOMIC_RELAXED);
+	}
+
+	parallelPrefixSum(&offsets[0], numKeys + 1);
+
+	std::vector<int> cursor(offsets.begin(), offsets.end() - 1);
+
+	#pragma omp parallel for
+	for (int i = 0; i < n; i++) {
+		items[__atomic_fetch_add(&cursor[key(i)], 1, __ATOMIC_RELAXED)] = i;
+	}
+
+	// Threads fill a group in any order, sorting the small groups makes the result deterministic
+	#pragma omp parallel for schedule(dynamic, 1024)
+	for (int k = 0; k < numKeys; k++) {
+		std::sort(items.begin() + offsets[k], items.begin() + offsets[k + 1]);
+	}
+}
+
+#endif
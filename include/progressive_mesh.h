@@ -0,0 +1,38 @@
+#ifndef PROGRESSIVE_MESH_H
+#define PROGRESSIVE_MESH_H
+
+#include <mesh.h>
+#include <fstream>
+
+// Progressive Mesh Reader
+// Reads a file written by writeProgressiveMeshFile: the base mesh when opened, then the vertex
+// splits as they are asked for, so that a coarse mesh can be shown before the rest of the file
+// is read. The mesh refined so far is kept as indexed triangles, with each directed edge mapped to
+// its face, as a split only needs to find and renumber the faces around one vertex.
+struct ProgressiveMeshReader {
+	std::ifstream file;
+	string line;
+	bool hasLine;
+
+	vector<vec3> positions;
+	vector<int> indices;
+	EdgeHash<int> halfEdges;
+	int numSplits;
+
+	// Corners of the faces moved by a split
+	vector<int> fan;
+
+	ProgressiveMeshReader () : hasLine(false), numSplits(0) {};
+
+	bool open (string filename);
+
+	int readSplits (int maxSplits);
+
+	bool splitVertex (int vertex, int left, int right, vec3 position, vec3 newPosition);
+
+	Mesh *getMesh ();
+};
+
+Mesh *parseProgressiveMeshFile (string filename, int maxSplits);
+
+#endif
@@ -0,0 +1,137 @@
+#ifndef QUADRIC_H
+#define QUADRIC_H
+
+#include <cmath>
+#include <glm/glm.hpp>
+
+using glm::vec3;
+using glm::vec4;
+
+// Quadric
+// Symmetric 4x4 error quadric, stored as the 10 coefficients of its upper triangle
+//     | q[0] q[1] q[2] q[3] |
+//     |      q[4] q[5] q[6] |
+//     |           q[7] q[8] |
+//     |                q[9] |
+// The coefficients are a flat float array so that sums vectorize.
+struct Quadric {
+	float q[10];
+
+	Quadric () {
+		for (int i = 0; i < 10; i++)
+			q[i] = 0.0f;
+	};
+
+	// Quadric of the plane p = (a, b, c, d), i.e. the outer product p * p^T
+	Quadric (vec4 p) {
+		q[0] = p.x * p.x; q[1] = p.x * p.y; q[2] = p.x * p.z; q[3] = p.x * p.w;
+		q[4] = p.y * p.y; q[5] = p.y * p.z; q[6] = p.y * p.w;
+		q[7] = p.z * p.z; q[8] = p.z * p.w;
+		q[9] = p.w * p.w;
+	};
+
+	Quadric &operator+= (const Quadric &other) {
+		for (int i = 0; i < 10; i++)
+			q[i] += other.q[i];
+		return *this;
+	};
+
+	Quadric operator+ (const Quadric &other) const {
+		Quadric sum = *this;
+		sum += other;
+		return sum;
+	};
+
+	// Error v^T Q v of the point v = (x, y, z, 1)
+	float evaluate (vec3 v) const {
+		float x = v.x, y = v.y, z = v.z;
+		return q[0]*x*x + 2*q[1]*x*y + 2*q[2]*x*z + 2*q[3]*x
+			+ q[4]*y*y + 2*q[5]*y*z + 2*q[6]*y
+			+ q[7]*z*z + 2*q[8]*z
+			+ q[9];
+	};
+
+	// Solve the 3x3 system A x = r in double precision
+	// Returns false if A is (close to) singular, leaving x untouched
+	bool solve (const double r[3], double x[3]) const {
+		double a00 = q[0], a01 = q[1], a02 = q[2];
+		double a11 = q[4], a12 = q[5], a22 = q[7];
+
+		// Cofactors of the symmetric matrix A
+		double c00 = a11*a22 - a12*a12;
+		double c01 = a02*a12 - a01*a22;
+		double c02 = a01*a12 - a02*a11;
+		double c11 = a00*a22 - a02*a02;
+		double c12 = a01*a02 - a00*a12;
+		double c22 = a00*a11 - a01*a01;
+
+		double det = a00*c00 + a01*c01 + a02*c02;
+
+		// Relative to the scale of A, so the test does not depend on the size of the model
+		double scale = a00 + a11 + a22;
+		if (std::fabs(det) <= 1e-6 * scale * scale * scale)
+			return false;
+
+		double inv = 1.0 / det;
+		x[0] = (c00*r[0] + c01*r[1] + c02*r[2]) * inv;
+		x[1] = (c01*r[0] + c11*r[1] + c12*r[2]) * inv;
+		x[2] = (c02*r[0] + c12*r[1] + c22*r[2]) * inv;
+
+		return true;
+	};
+
+	// Solve for the point of minimum error, the 3x3 system A v = -b
+	// Returns false if A is (close to) singular, leaving v untouched
+	bool optimize (vec3 &v) const {
+		double b[3] = {-q[3], -q[6], -q[8]}, x[3];
+		if (!solve(b, x))
+			return false;
+
+		v = vec3(x[0], x[1], x[2]);
+		return true;
+	};
+
+	// Solve for the point of minimum error on the plane dot(normal, v) = offset, with a Lagrange
+	// multiplier: v = x + y (offset - dot(normal, x)) / dot(normal, y), for A x = -b and A y = normal
+	// Falls back to the unconstrained minimum if the plane is degenerate. Returns false if A is
+	// (close to) singular, leaving v untouched
+	bool optimize (vec3 &v, vec3 normal, float offset) const {
+		double b[3] = {-q[3], -q[6], -q[8]}, x[3];
+		double n[3] = {normal.x, normal.y, normal.z}, y[3];
+		if (!solve(b, x) || !solve(n, y))
+			return false;
+
+		double ny = n[0]*y[0] + n[1]*y[1] + n[2]*y[2];
+		double t = 0.0;
+		if (ny > 0.0)
+			t = (offset - (n[0]*x[0] + n[1]*x[1] + n[2]*x[2])) / ny;
+
+		v = vec3(x[0] + t*y[0], x[1] + t*y[1], x[2] + t*y[2]);
+		return true;
+	};
+
+	// Position of minimum error for collapsing the edge p1-p2
+	// Falls back to the best of the end points and the midpoint if the system is singular
+	vec3 getCollapsePosition (vec3 p1, vec3 p2) const {
+		vec3 v;
+		if (optimize(v))
+			return v;
+
+		vec3 mid = (p1 + p2) * 0.5f;
+		float e1 = evaluate(p1), e2 = evaluate(p2), em = evaluate(mid);
+
+		if (em <= e1 && em <= e2)
+			return mid;
+		else if (e1 <= e2)
+			return p1;
+		else
+			return p2;
+	};
+
+	// Pick the end point of least error, for collapses that keep one of the two vertices
+	vec3 getEndpointPosition (vec3 p1, vec3 p2) const {
+		return (evaluate(p1) <= evaluate(p2)) ? p1 : p2;
+	};
+};
+
+#endif
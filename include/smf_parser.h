@@ -14,7 +14,13 @@ using std::endl;
 using std::ifstream;
 using std::ofstream;
 
-Mesh *parseSmfFile(string);
+void readSmfHeader(const char *p, const char *end, int &numVertices, int &numFaces);
+void parseSmfRecords(const char *p, const char *end, vector<vec3> &positions, vector<int> &indices);
+void parseSmfRecordsParallel(const char *p, const char *end, vector<vec3> &positions, vector<int> &indices);
+Mesh *parseSmfFile(string, bool useCache = false, bool hasQuadrics = true);
+bool readSmfPositions(string filename, vector<vec3> &positions);
 void writeSmfFile(Mesh *mesh, string);
+bool parseVertexSplitRecord(const char *p, const char *end, int vertices[3], vec3 &position, vec3 &newPosition);
+void writeProgressiveMeshFile(Mesh *mesh, string);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,39 @@
+#ifndef SUBDIVISION_STENCILS_H
+#define SUBDIVISION_STENCILS_H
+
+#include <mesh.h>
+
+// Rows of a stencil table composed together by each thread at a time
+#define STENCIL_BLOCK_SIZE 1024
+
+// Subdivision Stencil Table
+// The subdivision of a mesh to some level as a sparse matrix from the positions of the base mesh
+// to those of the subdivided one, compiled once from the topology with all levels folded
+// together. A new pose of the base mesh, with the same faces, is then subdivided by one parallel
+// sparse matrix-vector product, and the normals and quadrics of the subdivided mesh are summed
+// again over its cached faces without rebuilding any of its topology.
+struct SubdivisionStencilTable {
+	int subdivisionType, subdivisionLevel;
+	int numBaseVertices, numVertices, numFaces;
+
+	// Vertex v of the subdivided mesh is the sum of weights[i] times base vertex sources[i]
+	// over i in [offsets[v - 1], offsets[v]), sources in increasing order
+	vector<int> offsets;
+	vector<int> sources;
+	vector<float> weights;
+
+	// Corners of the faces of the subdivided mesh, and the corners of each of its vertices
+	// grouped as cornerOffsets[v]..cornerOffsets[v + 1]
+	vector<int> indices;
+	vector<int> cornerOffsets, corners;
+
+	SubdivisionStencilTable () : subdivisionType(LOOP), subdivisionLevel(0), numBaseVertices(0), numVertices(0), numFaces(0) {};
+
+	Mesh *compile (Mesh *mesh, int subdivisionType, int subdivisionLevel);
+
+	bool apply (const vector<vec3> &basePositions, vector<vec3> &positions) const;
+
+	bool update (const vector<vec3> &basePositions, Mesh *subdividedMesh) const;
+};
+
+#endif
@@ -1,237 +1,381 @@
 #include <mesh.h>
+#include <parallel.h>
+#include <cluster_grid.h>
+#include <algorithm>
+#include <climits>
+#include <functional>
+#include <queue>
+#include <parallel/algorithm>
+
+// Mesh Constructor
+Mesh::Mesh () {
+	vertexMark = 0;
+	recordCollapses = false;
+	recordInverses = false;
+	collapseType = OPTIMAL_COLLAPSE;
+	hasQuadrics = true;
+	resize(0, 0, 0);
+}
+
+// Mesh Constructor, reserving storage for the counts given in the SMF header
+Mesh::Mesh (int numVertices, int numFaces) : Mesh() {
+	reserve(numVertices, numFaces * 3 / 2, numFaces);
+}
 
-// Vertex Constructor
-Vertex::Vertex (float x, float y, float z) {
-	this->position = vec3(x, y, z);
-	this->normal = vec3(0.0, 0.0, 0.0);
-	this->quadric = mat4(0.0);
+// Reserve storage for numVertices vertices, numEdges edges and numFaces faces
+void Mesh::reserve (int numVertices, int numEdges, int numFaces) {
+	positions.reserve(numVertices + 1);
+	normals.reserve(numVertices + 1);
+	if (hasQuadrics)
+		quadrics.reserve(numVertices + 1);
+	vertexEdge.reserve(numVertices + 1);
+	valences.reserve(numVertices + 1);
+
+	edgeStart.reserve(numEdges + 1);
+	edgeEnd.reserve(numEdges + 1);
+	edgeLeft.reserve(numEdges + 1);
+	edgeRight.reserve(numEdges + 1);
+	edgeLeftPrev.reserve(numEdges + 1);
+	edgeLeftNext.reserve(numEdges + 1);
+	edgeRightPrev.reserve(numEdges + 1);
+	edgeRightNext.reserve(numEdges + 1);
+
+	faceEdge.reserve(numFaces + 1);
+	faceNormals.reserve(numFaces + 1);
+
+	edgeMap.reserve(numEdges);
 }
 
-// Vertex Constructor
-Vertex::Vertex (vec3 position) {
-	this->position = position;
-	this->normal = vec3(0.0, 0.0, 0.0);
-	this->quadric = mat4(0.0);
+// Resize the mesh to numVertices vertices, numEdges edges and numFaces faces
+// New elements are zeroed and must be filled in by the caller
+void Mesh::resize (int numVertices, int numEdges, int numFaces) {
+	this->numVertices = numVertices;
+	this->numEdges = numEdges;
+	this->numFaces = numFaces;
+
+	positions.resize(numVertices + 1, vec3(0.0));
+	normals.resize(numVertices + 1, vec3(0.0));
+	quadrics.resize(hasQuadrics ? numVertices + 1 : 0, Quadric());
+	vertexEdge.resize(numVertices + 1, 0);
+	valences.resize(numVertices + 1, 0);
+
+	edgeStart.resize(numEdges + 1, 0);
+	edgeEnd.resize(numEdges + 1, 0);
+	edgeLeft.resize(numEdges + 1, 0);
+	edgeRight.resize(numEdges + 1, 0);
+	edgeLeftPrev.resize(numEdges + 1, 0);
+	edgeLeftNext.resize(numEdges + 1, 0);
+	edgeRightPrev.resize(numEdges + 1, 0);
+	edgeRightNext.resize(numEdges + 1, 0);
+
+	faceEdge.resize(numFaces + 1, 0);
+	faceNormals.resize(numFaces + 1, vec3(0.0));
 }
 
 // Compute Bounding Box
 void Mesh::computeBoundingBox () {
-	vec3 position = vertexMap[1]->position;
+	vec3 position = positions[1];
 	xMin = xMax = position.x;
 	yMin = yMax = position.y;
 	zMin = zMax = position.z;
 
 	for (int i = 1; i <= numVertices; i++) {
-		vec3 position = vertexMap[i]->position;
+		vec3 position = positions[i];
 		float xVal = position.x;
 		float yVal = position.y;
 		float zVal = position.z;
-		
+
 		if (xVal < xMin)
 			xMin = xVal;
-		
+
 		if (xVal > xMax)
 			xMax = xVal;
 
 		if (yVal < yMin)
 			yMin = yVal;
-		
+
 		if (yVal > yMax)
 			yMax = yVal;
 
 		if (zVal < zMin)
 			zMin = zVal;
-		
+
 		if (zVal > zMax)
 			zMax = zVal;
 	}
 }
 
 // Insert a vertex in the mesh
-Vertex *Mesh::insertVertex (float x, float y, float z) {
-	Vertex *vertex = new Vertex(x, y, z);
-
-	return insertVertex(vertex);
+int Mesh::insertVertex (float x, float y, float z) {
+	return insertVertex(vec3(x, y, z));
 }
 
 // Insert a vertex in the mesh
-Vertex *Mesh::insertVertex (Vertex *vertex) {
-	int index = vertexMap.size() + 1;
+int Mesh::insertVertex (vec3 position) {
+	positions.push_back(position);
+	normals.push_back(vec3(0.0));
+	if (hasQuadrics)
+		quadrics.push_back(Quadric());
+	vertexEdge.push_back(0);
+	valences.push_back(0);
 
-	vertexMap.insert(make_pair(index, vertex));
-	vertexIndexMap.insert(make_pair(vertex, index));
+	numVertices++;
 
-	numVertices = vertexMap.size();
+	return numVertices;
+}
+
+// Move a vertex to another index, updating the edges that refer to it
+void Mesh::moveVertex (int from, int to) {
+	positions[to] = positions[from];
+	normals[to] = normals[from];
+	if (hasQuadrics)
+		quadrics[to] = quadrics[from];
+	vertexEdge[to] = vertexEdge[from];
+	valences[to] = valences[from];
+
+	int e1 = vertexEdge[to];
+	if (e1 == 0)
+		return;
+
+	// Edges around the vertex are keyed by its old index
+	int e = e1;
+	do {
+		int next;
+		edgeMap.erase(getEdgeKey(edgeStart[e], edgeEnd[e]));
+
+		if (edgeStart[e] == from) {
+			edgeStart[e] = to;
+			next = edgeLeftPrev[e];
+		} else {
+			edgeEnd[e] = to;
+			next = edgeRightNext[e];
+		}
 
-	return vertex;
+		edgeMap.insert(getEdgeKey(edgeStart[e], edgeEnd[e]), e);
+		e = next;
+	} while (e != e1);
 }
 
 // Delete a vertex from the mesh
-void Mesh::deleteVertex (Vertex *vertex) {
-	int index = vertexIndexMap[vertex];
-	vertexIndexMap.erase(vertex);
+void Mesh::deleteVertex (int vertex) {
+	if (vertex != numVertices)
+		moveVertex(numVertices, vertex);
 
-	if (index == numVertices) {
-		vertexMap.erase(numVertices);
-	} else {
-		Vertex *last = vertexMap[numVertices];
-		vertexMap.erase(numVertices);
+	positions.pop_back();
+	normals.pop_back();
+	if (hasQuadrics)
+		quadrics.pop_back();
+	vertexEdge.pop_back();
+	valences.pop_back();
 
-		vertexMap[index] = last;
-		vertexIndexMap[last] = index;	
-	}
-	
 	numVertices--;
 }
 
 // Insert an edge in the mesh
-W_edge *Mesh::insertEdge (int v1, int v2) {
-	W_edge *edge = new W_edge(vertexMap[v1], vertexMap[v2]);
+int Mesh::insertEdge (int v1, int v2) {
+	edgeStart.push_back(v1);
+	edgeEnd.push_back(v2);
+	edgeLeft.push_back(0);
+	edgeRight.push_back(0);
+	edgeLeftPrev.push_back(0);
+	edgeLeftNext.push_back(0);
+	edgeRightPrev.push_back(0);
+	edgeRightNext.push_back(0);
 
-	int index = edgeMap.size() + 1;
+	numEdges++;
 
-	string edgeKey = getEdgeKey(v1, v2);
-	edgeMap.insert(make_pair(edgeKey, edge));
-	edgeKeyMap.insert(make_pair(index, edgeKey));
-	edgeIndexMap.insert(make_pair(edge, index));
+	edgeMap.insert(getEdgeKey(v1, v2), numEdges);
 
-	numEdges = edgeMap.size();
-	
-	return edge;
+	return numEdges;
 }
 
-// Delete an edge from the mesh
-void Mesh::deleteEdge (W_edge *edge) {
-	int index = edgeIndexMap[edge];
-	edgeIndexMap.erase(edge);
+// Replace the link from edge e to edge from by a link to edge to
+void replaceEdgeLink (Mesh *mesh, int e, int from, int to) {
+	if (mesh->edgeLeftPrev[e] == from)
+		mesh->edgeLeftPrev[e] = to;
 
-	string edgeKey = edgeKeyMap[index];
+	if (mesh->edgeLeftNext[e] == from)
+		mesh->edgeLeftNext[e] = to;
 
-	edgeMap.erase(edgeKey);
+	if (mesh->edgeRightPrev[e] == from)
+		mesh->edgeRightPrev[e] = to;
 
-	if (index == numEdges) {
-		edgeKeyMap.erase(numEdges);
-	} else {
-		string lastEdgeKey = edgeKeyMap[numEdges];
-		edgeKeyMap.erase(numEdges);
+	if (mesh->edgeRightNext[e] == from)
+		mesh->edgeRightNext[e] = to;
+}
+
+// Move an edge to another index, updating the vertices, faces and edges that refer to it
+void Mesh::moveEdge (int from, int to) {
+	edgeStart[to] = edgeStart[from];
+	edgeEnd[to] = edgeEnd[from];
+	edgeLeft[to] = edgeLeft[from];
+	edgeRight[to] = edgeRight[from];
+	edgeLeftPrev[to] = edgeLeftPrev[from];
+	edgeLeftNext[to] = edgeLeftNext[from];
+	edgeRightPrev[to] = edgeRightPrev[from];
+	edgeRightNext[to] = edgeRightNext[from];
+
+	int *index = edgeMap.find(getEdgeKey(edgeStart[to], edgeEnd[to]));
+	if (index != NULL && *index == from)
+		*index = to;
+
+	replaceEdgeLink(this, edgeLeftPrev[to], from, to);
+	replaceEdgeLink(this, edgeLeftNext[to], from, to);
+	replaceEdgeLink(this, edgeRightPrev[to], from, to);
+	replaceEdgeLink(this, edgeRightNext[to], from, to);
+
+	if (vertexEdge[edgeStart[to]] == from)
+		vertexEdge[edgeStart[to]] = to;
+
+	if (vertexEdge[edgeEnd[to]] == from)
+		vertexEdge[edgeEnd[to]] = to;
+
+	if (faceEdge[edgeLeft[to]] == from)
+		faceEdge[edgeLeft[to]] = to;
+
+	if (faceEdge[edgeRight[to]] == from)
+		faceEdge[edgeRight[to]] = to;
+}
+
+// Delete an edge from the mesh
+void Mesh::deleteEdge (int edge) {
+	// After a collapse the key may already belong to the edge that replaced this one
+	uint64_t edgeKey = getEdgeKey(edgeStart[edge], edgeEnd[edge]);
+	int *index = edgeMap.find(edgeKey);
+	if (index != NULL && *index == edge)
+		edgeMap.erase(edgeKey);
+
+	if (edge != numEdges)
+		moveEdge(numEdges, edge);
+
+	edgeStart.pop_back();
+	edgeEnd.pop_back();
+	edgeLeft.pop_back();
+	edgeRight.pop_back();
+	edgeLeftPrev.pop_back();
+	edgeLeftNext.pop_back();
+	edgeRightPrev.pop_back();
+	edgeRightNext.pop_back();
 
-		edgeKeyMap[index] = lastEdgeKey;
-		edgeIndexMap[edgeMap[lastEdgeKey]] = index;	
-	}
-	
 	numEdges--;
 }
 
 // Insert a face in the mesh
-Face *Mesh::insertFace (W_edge *edge) {
-	Face *face = new Face(edge);
-
-	int index = faceMap.size() + 1;
-	
-	faceMap.insert(make_pair(index, face));
-	faceIndexMap.insert(make_pair(face, index));
+int Mesh::insertFace (int edge) {
+	faceEdge.push_back(edge);
+	faceNormals.push_back(vec3(0.0));
 
-	numFaces = faceMap.size();
+	numFaces++;
 
-	return face;
+	return numFaces;
 }
 
-// Delete a face from the mesh
-void Mesh::deleteFace (Face *face) {
-	int index = faceIndexMap[face];
-	faceIndexMap.erase(face);
+// Move a face to another index, updating the edges that refer to it
+void Mesh::moveFace (int from, int to) {
+	int edges[3];
+	getAllEdgesForFace(from, edges);
 
-	if (index == numFaces) {
-		faceMap.erase(numFaces);
-		faceNormalMap.erase(to_string(numFaces));
-	} else {
-		Face *last = faceMap[numFaces];
-		faceMap.erase(numFaces);
+	for (int i = 0; i < 3; i++) {
+		if (edgeLeft[edges[i]] == from)
+			edgeLeft[edges[i]] = to;
+		else
+			edgeRight[edges[i]] = to;
+	}
+
+	faceEdge[to] = faceEdge[from];
+	faceNormals[to] = faceNormals[from];
+}
 
-		vec3 lastNormal = faceNormalMap[to_string(numFaces)];
-		faceNormalMap.erase(to_string(numFaces));
+// Delete a face from the mesh
+void Mesh::deleteFace (int face) {
+	if (face != numFaces)
+		moveFace(numFaces, face);
 
-		faceMap[index] = last;
-		faceNormalMap[to_string(index)] = lastNormal;
-		faceIndexMap[last] = index;	
-	}
+	faceEdge.pop_back();
+	faceNormals.pop_back();
 
-	numFaces--;	
+	numFaces--;
 }
 
 // Insert a triangle in the mesh
 void Mesh::insertTriangle (int v1, int v2, int v3) {
-	W_edge *e1, *e2, *e3;
-	Face *f;
+	int e1, e2, e3;
+	int f;
 	int e1Dir, e2Dir, e3Dir;
-	
+
 	e1 = getEdge(v1, v2);
 
-	if (e1 == NULL) {
+	if (e1 == 0) {
 		e1 = insertEdge(v1, v2);
 		e1Dir = 1;
-		
-		f = insertFace(e1); 
-		e1->left = f;
-		
-		vertexMap[v1]->edge = e1;
+
+		f = insertFace(e1);
+		edgeLeft[e1] = f;
+
+		vertexEdge[v1] = e1;
+		valences[v1]++;
+		valences[v2]++;
 	} else {
 		e1Dir = -1;
-		f = insertFace(e1); 
-		e1->right = f;		
+		f = insertFace(e1);
+		edgeRight[e1] = f;
 	}
 
 	e2 = getEdge(v2, v3);
 
-	if (e2 == NULL) {
+	if (e2 == 0) {
 		e2 = insertEdge(v2, v3);
 		e2Dir = 1;
 
-		e2->left = f;
-		
-		vertexMap[v2]->edge = e2;
+		edgeLeft[e2] = f;
+
+		vertexEdge[v2] = e2;
+		valences[v2]++;
+		valences[v3]++;
 	} else {
 		e2Dir = -1;
-		e2->right = f;
+		edgeRight[e2] = f;
 	}
-	
+
 	e3 = getEdge(v3, v1);
 
-	if (e3 == NULL) {
+	if (e3 == 0) {
 		e3 = insertEdge(v3, v1);
 		e3Dir = 1;
 
-		e3->left = f;
+		edgeLeft[e3] = f;
 
-		vertexMap[v3]->edge = e3;
+		vertexEdge[v3] = e3;
+		valences[v3]++;
+		valences[v1]++;
 	} else {
 		e3Dir = -1;
-		e3->right = f;
+		edgeRight[e3] = f;
 	}
 
 	// Update edge references
 	if (e1Dir > 0) {
-		e1->left_next = e2;
-		e1->left_prev = e3;
+		edgeLeftNext[e1] = e2;
+		edgeLeftPrev[e1] = e3;
 	} else {
-		e1->right_next = e3;
-		e1->right_prev = e2;
+		edgeRightNext[e1] = e3;
+		edgeRightPrev[e1] = e2;
 	}
 
 	if (e2Dir > 0) {
-		e2->left_next = e3;
-		e2->left_prev = e1;
+		edgeLeftNext[e2] = e3;
+		edgeLeftPrev[e2] = e1;
 	} else {
-		e2->right_next = e1;
-		e2->right_prev = e3;
+		edgeRightNext[e2] = e1;
+		edgeRightPrev[e2] = e3;
 	}
 
 	if (e3Dir > 0) {
-		e3->left_next = e1;
-		e3->left_prev = e2;
+		edgeLeftNext[e3] = e1;
+		edgeLeftPrev[e3] = e2;
 	} else {
-		e3->right_next = e2;
-		e3->right_prev = e1;
+		edgeRightNext[e3] = e2;
+		edgeRightPrev[e3] = e1;
 	}
 
 	insertFaceNormal(f, v1, v2, v3);
@@ -240,128 +384,253 @@ void Mesh::insertTriangle (int v1, int v2, int v3) {
 	updateQuadricForEachVertex(f, v1, v2, v3);
 }
 
+// Build the mesh from an array of vertex positions and an array of three vertex indices per face
+// Both use the mesh numbering: vertexPositions[0] is unused and indices start at 1.
+// The result is numbered exactly as if each triangle had been passed to insertTriangle in order.
+void Mesh::buildFromIndexedTriangles (const vector<vec3> &vertexPositions, const vector<int> &indices) {
+	int nv = vertexPositions.size() - 1;
+	int nf = indices.size() / 3;
+	int numHalfEdges = 3 * nf;
+
+	// Half edge h runs from corner h of face h / 3 + 1 to the next corner of the face
+	vector<int> halfEdgeEnd(numHalfEdges);
+
+	#pragma omp parallel for
+	for (int h = 0; h < numHalfEdges; h++) {
+		halfEdgeEnd[h] = indices[h - h % 3 + (h + 1) % 3];
+	}
+
+	// Group half edges by their lower vertex, twins then share a group and the higher vertex
+	vector<int> offsets, groups;
+	parallelGroupBy(numHalfEdges, nv + 1, [&] (int h) { return std::min(indices[h], halfEdgeEnd[h]); }, offsets, groups);
+
+	// The first half edge of a pair creates the edge and becomes its left side, the second one its right side
+	// Non-manifold edges shared by more than two faces are not supported, as with insertTriangle
+	vector<int> halfEdgeFirst(numHalfEdges);
+	vector<int> halfEdgeTwins(numHalfEdges);
+	vector<int> edgeIndex(numHalfEdges);
+
+	#pragma omp parallel for schedule(dynamic, 1024)
+	for (int v = 1; v <= nv; v++) {
+		for (int i = offsets[v]; i < offsets[v + 1]; i++) {
+			int h = groups[i];
+			int other = std::max(indices[h], halfEdgeEnd[h]);
+
+			halfEdgeFirst[h] = h;
+			halfEdgeTwins[h] = 0;
+
+			for (int j = offsets[v]; j < i; j++) {
+				int g = groups[j];
+				if (std::max(indices[g], halfEdgeEnd[g]) == other) {
+					if (halfEdgeTwins[h] == 0)
+						halfEdgeFirst[h] = g;
+					halfEdgeTwins[h]++;
+				}
+			}
+
+			edgeIndex[h] = (halfEdgeTwins[h] == 0) ? 1 : 0;
+		}
+	}
+
+	// Edges are numbered by the order of their first half edge
+	if (numHalfEdges > 0)
+		parallelPrefixSum(&edgeIndex[0], numHalfEdges);
+
+	int ne = (numHalfEdges > 0) ? edgeIndex[numHalfEdges - 1] : 0;
+
+	// Start from zeroed arrays and a new history
+	resize(0, 0, 0);
+	resize(nv, ne, nf);
+	collapseRecords.clear();
+	collapseInverses.clear();
+	std::copy(vertexPositions.begin(), vertexPositions.end(), positions.begin());
+
+	vector<int> halfEdgeEdge(numHalfEdges);
+	vector<uint64_t> edgeKeys(ne);
+	vector<int> edgeValues(ne);
+
+	#pragma omp parallel for
+	for (int h = 0; h < numHalfEdges; h++) {
+		int e = edgeIndex[halfEdgeFirst[h]];
+		halfEdgeEdge[h] = e;
+
+		if (halfEdgeTwins[h] == 0) {
+			edgeStart[e] = indices[h];
+			edgeEnd[e] = halfEdgeEnd[h];
+			edgeLeft[e] = h / 3 + 1;
+
+			edgeKeys[e - 1] = getEdgeKey(indices[h], halfEdgeEnd[h]);
+			edgeValues[e - 1] = e;
+		} else if (halfEdgeTwins[h] == 1) {
+			edgeRight[e] = h / 3 + 1;
+		}
+	}
+
+	// Wire the winged edge links of each face
+	#pragma omp parallel for
+	for (int f = 1; f <= nf; f++) {
+		int *faceEdges = &halfEdgeEdge[3 * (f - 1)];
+		faceEdge[f] = faceEdges[0];
+
+		for (int j = 0; j < 3; j++) {
+			int e = faceEdges[j];
+			int next = faceEdges[(j + 1) % 3];
+			int prev = faceEdges[(j + 2) % 3];
+
+			if (edgeLeft[e] == f) {
+				edgeLeftNext[e] = next;
+				edgeLeftPrev[e] = prev;
+			} else if (edgeRight[e] == f) {
+				edgeRightNext[e] = prev;
+				edgeRightPrev[e] = next;
+			}
+		}
+
+		faceNormals[f] = getFaceNormalVector(positions[indices[3 * f - 3]], positions[indices[3 * f - 2]], positions[indices[3 * f - 1]]);
+	}
+
+	// As in insertTriangle, the last edge created from a vertex becomes its edge
+	for (int e = 1; e <= ne; e++) {
+		vertexEdge[edgeStart[e]] = e;
+	}
+
+	computeValences();
+
+	edgeMap.clear();
+	if (ne > 0)
+		edgeMap.insertAll(ne, &edgeKeys[0], &edgeValues[0]);
+
+	// Sum the normals and quadrics of the faces around each vertex, in face order
+	parallelGroupBy(numHalfEdges, nv + 1, [&] (int h) { return indices[h]; }, offsets, groups);
+
+	#pragma omp parallel for schedule(dynamic, 1024)
+	for (int v = 1; v <= nv; v++) {
+		for (int i = offsets[v]; i < offsets[v + 1]; i++) {
+			int f = groups[i] / 3 + 1;
+			normals[v] = normals[v] + faceNormals[f];
+			if (hasQuadrics)
+				quadrics[v] += getQuadric(f, v);
+		}
+	}
+}
+
 // Insert the face normal for vertex v1
-void Mesh::insertFaceNormal (Face *f, int v1, int v2, int v3) {
-	vec3 faceNormal = getFaceNormalVector(vertexMap[v1], vertexMap[v2], vertexMap[v3]);
-	faceNormalMap.insert(make_pair(to_string(faceIndexMap[f]), faceNormal));
+void Mesh::insertFaceNormal (int f, int v1, int v2, int v3) {
+	faceNormals[f] = getFaceNormalVector(positions[v1], positions[v2], positions[v3]);
 }
 
 // Update the vertex normal for vertex v by adding the face normal
-void Mesh::updateVertexNormalForVertex (Face *f, int v) {
-	Vertex *vertex = vertexMap[v];
-	vertex->normal = vertex->normal + getFaceNormal(f);
+void Mesh::updateVertexNormalForVertex (int f, int v) {
+	normals[v] = normals[v] + faceNormals[f];
 }
 
 // Update the vertex normal for each vertex v1, v2, and v3
-void Mesh::updateVertexNormalForEachVertex (Face *f, int v1, int v2, int v3) {
+void Mesh::updateVertexNormalForEachVertex (int f, int v1, int v2, int v3) {
 	updateVertexNormalForVertex(f, v1);
 	updateVertexNormalForVertex(f, v2);
-	updateVertexNormalForVertex(f, v3);	
+	updateVertexNormalForVertex(f, v3);
 }
 
-// Fetch an edge between two vertices v1 and v2
-W_edge *Mesh::getEdge (int v1, int v2) {	
-	map<string, W_edge*>::iterator it = edgeMap.find(getEdgeKey(v1, v2));
-	
-	if (it != edgeMap.end())
-		return it->second;
+// Fetch an edge between two vertices v1 and v2, 0 if there is none
+int Mesh::getEdge (int v1, int v2) {
+	int *edge = edgeMap.find(getEdgeKey(v1, v2));
+
+	if (edge != NULL)
+		return *edge;
 	else
-		return NULL;
+		return 0;
 }
 
-// Fetch the face normal for vertex
-vec3 Mesh::getFaceNormal (Face *f) {
-	map<string, vec3>::iterator it = faceNormalMap.find(to_string(faceIndexMap[f]));
-
-	if (it != faceNormalMap.end())
-		return it->second;
+// Fetch the face normal for a face
+vec3 Mesh::getFaceNormal (int f) {
+	return faceNormals[f];
 }
 
 // Get all edges for a face
-void Mesh::getAllEdgesForFace (Face *f, W_edge *edges[3]) {
-	W_edge *e = f->edge;
+void Mesh::getAllEdgesForFace (int f, int edges[3]) {
+	int e = faceEdge[f];
 
 	for (int i = 0; i < 3; i++) {
 		edges[i] = e;
 
-		if (e->right == f)
-			e = e->right_prev;
+		if (edgeRight[e] == f)
+			e = edgeRightPrev[e];
 		else
-			e = e->left_next;
+			e = edgeLeftNext[e];
 	}
 }
 
 // Get all vertices for a face
-void Mesh::getAllVerticesForFace (Face *f, Vertex *vertices[3]) {
-	W_edge *edge1 = f->edge;
+void Mesh::getAllVerticesForFace (int f, int vertices[3]) {
+	int edge1 = faceEdge[f];
 
-	if (edge1->right == f) {
-		vertices[0] = edge1->end;
-		vertices[1] = edge1->start;
-		vertices[2] = getNextVertex(edge1, edge1->right_next);
+	if (edgeRight[edge1] == f) {
+		vertices[0] = edgeEnd[edge1];
+		vertices[1] = edgeStart[edge1];
+		vertices[2] = getNextVertex(edge1, edgeRightNext[edge1]);
 	} else {
-		vertices[0] = edge1->start;
-		vertices[1] = edge1->end;
-		vertices[2] = getNextVertex(edge1, edge1->left_next);
+		vertices[0] = edgeStart[edge1];
+		vertices[1] = edgeEnd[edge1];
+		vertices[2] = getNextVertex(edge1, edgeLeftNext[edge1]);
 	}
 }
 
-// Compute the key to store the edge between vertices v1, and v2 in edgeMap
-string getEdgeKey (int v1, int v2) {
-	if (v1 < v2)
-		return to_string(v1) + "|" + to_string(v2);
-	else
-		return to_string(v2) + "|" + to_string(v1);
-}
-
 // Get the face normal from the first vertex
-vec3 getFaceNormalVector (Vertex *v1, Vertex *v2, Vertex *v3) {
-	vec3 e1 = v2->position - v1->position;
-	vec3 e2 = v3->position - v1->position;
+vec3 getFaceNormalVector (vec3 p1, vec3 p2, vec3 p3) {
+	vec3 e1 = p2 - p1;
+	vec3 e2 = p3 - p1;
 
 	return normalize(cross(e1, e2));
 }
 
 // Get next vertex
-Vertex *getNextVertex (W_edge *edge, W_edge *next_edge) {
-	if (edge->start == next_edge->start || edge->end == next_edge->start) {
-		return next_edge->end;
-	} else if (edge->start == next_edge->end || edge->end == next_edge->end) {
-		return next_edge->start;
+int Mesh::getNextVertex (int edge, int nextEdge) {
+	int start = edgeStart[nextEdge];
+	int end = edgeEnd[nextEdge];
+
+	if (edgeStart[edge] == start || edgeEnd[edge] == start) {
+		return end;
+	} else if (edgeStart[edge] == end || edgeEnd[edge] == end) {
+		return start;
 	}
 }
 
-// Subdivision
+// If we have an edge and a vertex, get the other vertex
+int Mesh::getOtherVertex (int edge, int vertex) {
+	if (edgeStart[edge] == vertex)
+		return edgeEnd[edge];
+	else
+		return edgeStart[edge];
+}
 
-// Compute mid point vertex for an edge
-Vertex *computeMidpoint (W_edge *edge) {
-	Vertex *left_vertex = getNextVertex(edge, edge->left_next);
-	Vertex *right_vertex = getNextVertex(edge, edge->right_next);
+// Get the degree of a vertex, from the valence kept for it
+int Mesh::getDegreeOfVertex (int vertex) {
+	return valences[vertex];
+}
 
-	vec3 newVertexPosition = edge->start->position * (3.0f/8.0f);
-	newVertexPosition += edge->end->position * (3.0f/8.0f);
-	newVertexPosition += left_vertex->position * (1.0f/8.0f);
-	newVertexPosition += right_vertex->position * (1.0f/8.0f);
+// Count the edges at each vertex, once the edges are in place
+void Mesh::computeValences () {
+	std::fill(valences.begin(), valences.end(), 0);
 
-	return new Vertex(newVertexPosition);
+	for (int e = 1; e <= numEdges; e++) {
+		valences[edgeStart[e]]++;
+		valences[edgeEnd[e]]++;
+	}
 }
 
-// Get the degree of a vertex
-int getDegreeOfVertex(Vertex *vertex) {
-	W_edge *e1 = vertex->edge;
-	int count = 0;
+// Subdivision
 
-	W_edge *e = e1;
-	do {
-		if (e->start == vertex) {
-			e = e->left_prev;
-		} else {
-			e = e->right_next;
-		}
-		count++;
-	} while (e != e1);
+// Compute mid point vertex for an edge
+vec3 Mesh::computeMidpoint (int edge) {
+	int leftVertex = getNextVertex(edge, edgeLeftNext[edge]);
+	int rightVertex = getNextVertex(edge, edgeRightNext[edge]);
 
-	return count;
+	vec3 newVertexPosition = positions[edgeStart[edge]] * (3.0f/8.0f);
+	newVertexPosition += positions[edgeEnd[edge]] * (3.0f/8.0f);
+	newVertexPosition += positions[leftVertex] * (1.0f/8.0f);
+	newVertexPosition += positions[rightVertex] * (1.0f/8.0f);
+
+	return newVertexPosition;
 }
 
 // Compute beta for Loop subdivision
@@ -372,247 +641,387 @@ float computeBeta (int k) {
 	return beta;
 }
 
+// Compute weights for Butterfly subdivision
+float computeButterflyWeight (int k, int j) {
+	float weight;
+
+	if (k == 3) {
+		if (j == 0)
+			weight = 5.0/12.0;
+		else
+			weight = -1.0/12.0;
+	} else if (k == 4) {
+		if (j == 0)
+			weight = 3.0/8.0;
+		else if (j == 2)
+			weight = -1.0/8.0;
+		else
+			weight = 0;
+	} else {
+		weight = (1.0/k) * (1.0/4.0 + cos((2.0*j*PI) / k) + (1.0/2.0)*cos((4.0*j*PI) / k));
+	}
+
+	return weight;
+}
+
+// Subdivision Weights
+// Loop's beta and the Butterfly weights of every valence up to MAX_WEIGHT_VALENCE, computed once
+// by computeBeta and computeButterflyWeight so that the stencils only look them up. The Butterfly
+// centre weight is one minus the others, summed in the order the stencil used to. The tables are
+// filled by a constructor when the program loads: in C++11 neither cos nor pow is constexpr, and a
+// constexpr function cannot hold the loops, so they cannot be built at compile time.
+struct SubdivisionWeights {
+	float beta[MAX_WEIGHT_VALENCE + 1];
+	float butterfly[MAX_WEIGHT_VALENCE + 1][MAX_WEIGHT_VALENCE];
+	float butterflyCentre[MAX_WEIGHT_VALENCE + 1];
+
+	SubdivisionWeights () {
+		beta[0] = butterflyCentre[0] = 0.0f;
+
+		for (int k = 1; k <= MAX_WEIGHT_VALENCE; k++) {
+			beta[k] = computeBeta(k);
+
+			float total_weights = 0;
+			for (int j = 0; j < k; j++) {
+				butterfly[k][j] = computeButterflyWeight(k, j);
+				total_weights += butterfly[k][j];
+			}
+			butterflyCentre[k] = 1 - total_weights;
+		}
+	};
+};
+
+static const SubdivisionWeights subdivisionWeights;
+
+// Regular Loop vertex rule for a vertex of valence 6 with its neighbours gathered in ring, with the
+// weights written in: 5/8 for the vertex and 1/16 for each neighbour, which is what computeBeta(6)
+// rounds to.
+static inline vec3 applyRegularLoopStencil (vec3 position, const vec3 ring[6]) {
+	vec3 neighbours = (ring[0] + ring[1]) + (ring[2] + ring[3]) + (ring[4] + ring[5]);
+
+	return position * (5.0f/8.0f) + neighbours * (1.0f/16.0f);
+}
+
 // Compute new vertex for a vertex
-Vertex *computeNewVertex (Vertex *vertex) {
+// Regular vertices take the valence 6 stencil with fixed weights, others the general one.
+vec3 Mesh::computeNewVertex (int vertex) {
 	int k = getDegreeOfVertex(vertex);
-	float beta = computeBeta(k);
 
-	vec3 newVertexPosition = vertex->position * (1.0f - k*beta);
+	if (k == 6) {
+		vec3 ring[6];
+
+		int e = vertexEdge[vertex];
+		for (int i = 0; i < 6; i++) {
+			if (edgeStart[e] == vertex) {
+				ring[i] = positions[getNextVertex(e, edgeLeftPrev[e])];
+				e = edgeLeftPrev[e];
+			} else {
+				ring[i] = positions[getNextVertex(e, edgeRightNext[e])];
+				e = edgeRightNext[e];
+			}
+		}
+
+		return applyRegularLoopStencil(positions[vertex], ring);
+	}
+
+	float beta = (k <= MAX_WEIGHT_VALENCE) ? subdivisionWeights.beta[k] : computeBeta(k);
+	vec3 newVertexPosition = positions[vertex] * (1.0f - k*beta);
 
-	Vertex *nextVertex;
-	W_edge *e = vertex->edge;
+	int nextVertex;
+	int e = vertexEdge[vertex];
 	for (int i = 0; i < k; i++) {
-		if (e->start == vertex) {
-			nextVertex = getNextVertex(e, e->left_prev);
-			e = e->left_prev;
+		if (edgeStart[e] == vertex) {
+			nextVertex = getNextVertex(e, edgeLeftPrev[e]);
+			e = edgeLeftPrev[e];
 		} else {
-			nextVertex = getNextVertex(e, e->right_next);
-			e = e->right_next;
+			nextVertex = getNextVertex(e, edgeRightNext[e]);
+			e = edgeRightNext[e];
 		}
 
-		newVertexPosition += nextVertex->position * beta;
+		newVertexPosition += positions[nextVertex] * beta;
 	}
 
-	return new Vertex(newVertexPosition);
+	return newVertexPosition;
 }
 
-// Perform Loop subdivision
-Mesh *Mesh::loopSubdivision () {
-	Mesh *subdividedMesh = new Mesh();
-	map<string, Vertex*> edgeVertexMap;
-	Vertex *newVertex;
+// Set the three edges of a face, given in face order with the side of each edge the face is on
+static inline void setFaceEdges (Mesh *mesh, int f, const int edges[3], const bool isLeft[3]) {
+	mesh->faceEdge[f] = edges[0];
 
-	// Compute new vertices for each vertex
-	for (int i = 1; i <= numVertices; i++) {
-		newVertex = computeNewVertex(vertexMap[i]);
-		subdividedMesh->insertVertex(newVertex);
+	for (int j = 0; j < 3; j++) {
+		int e = edges[j];
+		int next = edges[(j + 1) % 3];
+		int prev = edges[(j + 2) % 3];
+
+		if (isLeft[j]) {
+			mesh->edgeLeft[e] = f;
+			mesh->edgeLeftNext[e] = next;
+			mesh->edgeLeftPrev[e] = prev;
+		} else {
+			mesh->edgeRight[e] = f;
+			mesh->edgeRightNext[e] = prev;
+			mesh->edgeRightPrev[e] = next;
+		}
 	}
+}
 
-	// Compute new mid point vertices for each edge
-	W_edge *edge;
-	for (map<string, W_edge*>::const_iterator it = edgeMap.begin(); it != edgeMap.end(); it++) {
-		edge = it->second;
+// Build the topology of the subdivided mesh, splitting each face into four, once its positions are set
+// Every element of the subdivided mesh has a fixed slot, so all passes run in parallel without any
+// lookups. The vertex for edge e is numbered numVertices + e, edge e splits into edges 2e - 1 (from
+// its start) and 2e (to its end), and face f with corners a, b, c and edge vertices p, q, r becomes
+// faces 4f - 3 to 4f: (a, p, r), (b, q, p), (c, r, q) and (p, q, r), whose inner edges p->q, q->r and
+// r->p are 2 * numEdges + 3f - 2 to 2 * numEdges + 3f.
+void Mesh::splitFaces (Mesh *subdividedMesh) {
+	Mesh *mesh = subdividedMesh;
+	int nv = numVertices + numEdges;
+	int ne = 2 * numEdges + 3 * numFaces;
+	int nf = 4 * numFaces;
+
+	// Halves of each edge
+	#pragma omp parallel for
+	for (int e = 1; e <= numEdges; e++) {
+		int midpoint = numVertices + e;
+
+		mesh->edgeStart[2 * e - 1] = edgeStart[e];
+		mesh->edgeEnd[2 * e - 1] = midpoint;
+		mesh->edgeStart[2 * e] = midpoint;
+		mesh->edgeEnd[2 * e] = edgeEnd[e];
+
+		mesh->vertexEdge[midpoint] = 2 * e - 1;
+
+		// Joined to both end points and to two more edge vertices in each face
+		mesh->valences[midpoint] = 2 + 2 * ((edgeLeft[e] != 0) + (edgeRight[e] != 0));
+	}
 
-		int startIndex = vertexIndexMap[edge->start];
-		int endIndex = vertexIndexMap[edge->end];
+	#pragma omp parallel for
+	for (int v = 1; v <= numVertices; v++) {
+		int e = vertexEdge[v];
+		mesh->vertexEdge[v] = (edgeStart[e] == v) ? 2 * e - 1 : 2 * e;
+		mesh->valences[v] = valences[v];
+	}
+
+	// Split each face, its edges and the sides of the edge halves that it covers
+	#pragma omp parallel for
+	for (int f = 1; f <= numFaces; f++) {
+		int edges[3];
+		getAllEdgesForFace(f, edges);
+
+		// Each side runs from corner j to the edge vertex and on to corner j + 1
+		int midpoints[3], firstHalves[3], secondHalves[3];
+		bool isLeft[3];
+
+		for (int j = 0; j < 3; j++) {
+			int e = edges[j];
+			isLeft[j] = edgeLeft[e] == f;
+			midpoints[j] = numVertices + e;
+			firstHalves[j] = isLeft[j] ? 2 * e - 1 : 2 * e;
+			secondHalves[j] = isLeft[j] ? 2 * e : 2 * e - 1;
+		}
+
+		int inner = 2 * numEdges + 3 * f - 2;
+		for (int j = 0; j < 3; j++) {
+			mesh->edgeStart[inner + j] = midpoints[j];
+			mesh->edgeEnd[inner + j] = midpoints[(j + 1) % 3];
+		}
+
+		// The corner face at corner j holds the inner edge j - 1 backwards
+		for (int j = 0; j < 3; j++) {
+			int cornerEdges[3] = {firstHalves[j], inner + (j + 2) % 3, secondHalves[(j + 2) % 3]};
+			bool cornerIsLeft[3] = {isLeft[j], false, isLeft[(j + 2) % 3]};
+			setFaceEdges(mesh, 4 * f - 3 + j, cornerEdges, cornerIsLeft);
+		}
 
-		newVertex = computeMidpoint(edge);
-		edgeVertexMap.insert(make_pair(getEdgeKey(startIndex, endIndex), newVertex));
-		subdividedMesh->insertVertex(newVertex);
+		int innerEdges[3] = {inner, inner + 1, inner + 2};
+		bool innerIsLeft[3] = {true, true, true};
+		setFaceEdges(mesh, 4 * f, innerEdges, innerIsLeft);
 	}
 
-	// Finish by adding connections
-	Face *face;
-	Vertex *vertices[3];
-	for (int i = 1; i <= numFaces; i++) {
-		face = faceMap[i];
-		getAllVerticesForFace(face, vertices);
+	#pragma omp parallel for
+	for (int f = 1; f <= nf; f++) {
+		int vertices[3];
+		mesh->getAllVerticesForFace(f, vertices);
+		mesh->faceNormals[f] = getFaceNormalVector(mesh->positions[vertices[0]], mesh->positions[vertices[1]], mesh->positions[vertices[2]]);
+	}
 
-		int a = vertexIndexMap[vertices[0]];
-		int b = vertexIndexMap[vertices[1]];
-		int c = vertexIndexMap[vertices[2]];
+	// Sum the normals and quadrics of the faces around each vertex
+	#pragma omp parallel for schedule(dynamic, 1024)
+	for (int v = 1; v <= nv; v++) {
+		int e1 = mesh->vertexEdge[v];
+		int e = e1;
+		do {
+			int f;
+			if (mesh->edgeStart[e] == v) {
+				f = mesh->edgeLeft[e];
+				e = mesh->edgeLeftPrev[e];
+			} else {
+				f = mesh->edgeRight[e];
+				e = mesh->edgeRightNext[e];
+			}
+
+			mesh->normals[v] = mesh->normals[v] + mesh->faceNormals[f];
+			if (mesh->hasQuadrics)
+				mesh->quadrics[v] += mesh->getQuadric(f, v);
+		} while (e != e1);
+	}
 
-		int p = subdividedMesh->vertexIndexMap[edgeVertexMap[getEdgeKey(a, b)]];
-		int q = subdividedMesh->vertexIndexMap[edgeVertexMap[getEdgeKey(b, c)]];
-		int r = subdividedMesh->vertexIndexMap[edgeVertexMap[getEdgeKey(c, a)]];
+	vector<uint64_t> edgeKeys(ne);
+	vector<int> edgeValues(ne);
 
-		subdividedMesh->insertTriangle(a, p, r);
-		subdividedMesh->insertTriangle(b, q, p);
-		subdividedMesh->insertTriangle(c, r, q);
-		subdividedMesh->insertTriangle(p, q, r);
+	#pragma omp parallel for
+	for (int e = 1; e <= ne; e++) {
+		edgeKeys[e - 1] = getEdgeKey(mesh->edgeStart[e], mesh->edgeEnd[e]);
+		edgeValues[e - 1] = e;
 	}
 
-	return subdividedMesh;
+	mesh->edgeMap.clear();
+	if (ne > 0)
+		mesh->edgeMap.insertAll(ne, &edgeKeys[0], &edgeValues[0]);
 }
 
-// Check if a vertex is regular
-bool isRegular (Vertex *vertex) {
-	int degree = getDegreeOfVertex(vertex);
-	return degree == 6;
-}
+// Perform Loop subdivision
+// The vertex points, edge points and face splits are three parallel passes over the coarse mesh.
+Mesh *Mesh::loopSubdivision () {
+	Mesh *subdividedMesh = new Mesh();
+	subdividedMesh->hasQuadrics = hasQuadrics;
+	subdividedMesh->resize(numVertices + numEdges, 2 * numEdges + 3 * numFaces, 4 * numFaces);
 
-// Compute weights for Butterfly subdivision
-float computeButterflyWeight (int k, int j) {
-	float weight;
+	vector<vec3> &newPositions = subdividedMesh->positions;
 
-	if (k == 3) {
-		if (j == 0)
-			weight = 5.0/12.0;
-		else
-			weight = -1.0/12.0;
-	} else if (k == 4) {
-		if (j == 0)
-			weight = 3.0/8.0;
-		else if (j == 2)
-			weight = -1.0/8.0;
-		else
-			weight = 0;
-	} else {
-		weight = (1.0/k) * (1.0/4.0 + cos((2.0*j*PI) / k) + (1.0/2.0)*cos((4.0*j*PI) / k));
+	// Compute new vertices for each vertex
+	#pragma omp parallel for schedule(dynamic, 1024)
+	for (int i = 1; i <= numVertices; i++) {
+		newPositions[i] = computeNewVertex(i);
 	}
 
-	return weight;
+	// Compute new mid point vertices for each edge
+	#pragma omp parallel for
+	for (int i = 1; i <= numEdges; i++) {
+		newPositions[numVertices + i] = computeMidpoint(i);
+	}
+
+	// Finish by adding connections
+	splitFaces(subdividedMesh);
+
+	return subdividedMesh;
 }
 
-// If we have an edge and a vertex, get the other vertex
-Vertex *getOtherVertex(W_edge *edge, Vertex *vertex) {
-	if (edge->start == vertex)
-		return edge->end;
-	else 
-		return edge->start;
+// Check if a vertex is regular
+bool Mesh::isRegular (int vertex) {
+	int degree = getDegreeOfVertex(vertex);
+	return degree == 6;
 }
 
 // Compute new vertex around irregular vertex
-Vertex *computeNewVertexAroundIrregularVertex (W_edge *edge, Vertex *vertex) {
+// The weights come from the table up to MAX_WEIGHT_VALENCE and are computed above it.
+vec3 Mesh::computeNewVertexAroundIrregularVertex (int edge, int vertex) {
 	int k = getDegreeOfVertex(vertex);
+	bool hasTable = k <= MAX_WEIGHT_VALENCE;
+	const float *weights = hasTable ? subdivisionWeights.butterfly[k] : NULL;
 	float total_weights = 0;
 
-	Vertex *otherVertex = getOtherVertex(edge, vertex);
-	float s0weight = computeButterflyWeight(k, 0);
+	int otherVertex = getOtherVertex(edge, vertex);
+	float s0weight = hasTable ? weights[0] : computeButterflyWeight(k, 0);
 	total_weights += s0weight;
 
-	vec3 newVertexPosition = otherVertex->position * s0weight;
+	vec3 newVertexPosition = positions[otherVertex] * s0weight;
 
-	Vertex *nextVertex;
-	W_edge *e = edge;
+	int nextVertex;
+	int e = edge;
 	for (int i = 1; i < k; i++) {
-		float s = computeButterflyWeight(k, i);
+		float s = hasTable ? weights[i] : computeButterflyWeight(k, i);
 		total_weights += s;
 
-		if (e->start == vertex) {
-			nextVertex = getNextVertex(e, e->left_prev);
-			e = e->left_prev;
+		if (edgeStart[e] == vertex) {
+			nextVertex = getNextVertex(e, edgeLeftPrev[e]);
+			e = edgeLeftPrev[e];
 		} else {
-			nextVertex = getNextVertex(e, e->right_next);
-			e = e->right_next;
+			nextVertex = getNextVertex(e, edgeRightNext[e]);
+			e = edgeRightNext[e];
 		}
 
-		newVertexPosition += nextVertex->position * s;
+		newVertexPosition += positions[nextVertex] * s;
 	}
 
-	newVertexPosition += vertex->position * (1 - total_weights);
+	newVertexPosition += positions[vertex] * (hasTable ? subdivisionWeights.butterflyCentre[k] : 1 - total_weights);
 
-	return new Vertex(newVertexPosition);
+	return newVertexPosition;
 }
 
 // Helper method to get a butterfly vertex
-Vertex *getButterflyVertex (W_edge *edge, W_edge *next_edge) {
-	Vertex *nextVertex = getNextVertex(edge, next_edge);
-
-	if (edge->left == next_edge->left || edge->right == next_edge->left)
-		return getNextVertex(next_edge, next_edge->right_next);
-	else if (edge->left == next_edge->right || edge->right == next_edge->right)
-		return getNextVertex(next_edge, next_edge->left_next);
+int Mesh::getButterflyVertex (int edge, int nextEdge) {
+	if (edgeLeft[edge] == edgeLeft[nextEdge] || edgeRight[edge] == edgeLeft[nextEdge])
+		return getNextVertex(nextEdge, edgeRightNext[nextEdge]);
+	else if (edgeLeft[edge] == edgeRight[nextEdge] || edgeRight[edge] == edgeRight[nextEdge])
+		return getNextVertex(nextEdge, edgeLeftNext[nextEdge]);
 }
 
 // Helper method to get all butterfly vertices
-void getButterflyVertices (W_edge *edge, Vertex *vertices[4]) {
-	vertices[0] = getButterflyVertex(edge, edge->left_prev);
-	vertices[1] = getButterflyVertex(edge, edge->left_next);
-	vertices[2] = getButterflyVertex(edge, edge->right_prev);
-	vertices[3] = getButterflyVertex(edge, edge->right_next);
+void Mesh::getButterflyVertices (int edge, int vertices[4]) {
+	vertices[0] = getButterflyVertex(edge, edgeLeftPrev[edge]);
+	vertices[1] = getButterflyVertex(edge, edgeLeftNext[edge]);
+	vertices[2] = getButterflyVertex(edge, edgeRightPrev[edge]);
+	vertices[3] = getButterflyVertex(edge, edgeRightNext[edge]);
 }
 
 // Compute new vertex for an edge
-Vertex *computeMidpointButterfly (W_edge *edge) {
-	bool isStartVertexRegular = isRegular(edge->start);
-	bool isEndVertexRegular = isRegular(edge->end);
+vec3 Mesh::computeMidpointButterfly (int edge) {
+	int start = edgeStart[edge];
+	int end = edgeEnd[edge];
+
+	bool isStartVertexRegular = isRegular(start);
+	bool isEndVertexRegular = isRegular(end);
 
 	vec3 newVertexPosition;
 	if (isStartVertexRegular && isEndVertexRegular) {
-		Vertex *left_vertex = getNextVertex(edge, edge->left_next);
-		Vertex *right_vertex = getNextVertex(edge, edge->right_next);
-		Vertex *butterflyVertices[4];
+		int leftVertex = getNextVertex(edge, edgeLeftNext[edge]);
+		int rightVertex = getNextVertex(edge, edgeRightNext[edge]);
+		int butterflyVertices[4];
 
 		getButterflyVertices(edge, butterflyVertices);
 
-		newVertexPosition = edge->start->position * (1.0f/2.0f);
-		newVertexPosition += edge->end->position * (1.0f/2.0f);
-		newVertexPosition += left_vertex->position * (1.0f/8.0f);
-		newVertexPosition += right_vertex->position * (1.0f/8.0f);
+		newVertexPosition = positions[start] * (1.0f/2.0f);
+		newVertexPosition += positions[end] * (1.0f/2.0f);
+		newVertexPosition += positions[leftVertex] * (1.0f/8.0f);
+		newVertexPosition += positions[rightVertex] * (1.0f/8.0f);
 
 		for (int i = 0; i < 4; i++) {
-			newVertexPosition += butterflyVertices[i]->position * (-1.0f/16.0f);
+			newVertexPosition += positions[butterflyVertices[i]] * (-1.0f/16.0f);
 		}
 	} else {
 		if (isStartVertexRegular)
-			return computeNewVertexAroundIrregularVertex(edge, edge->end);
+			return computeNewVertexAroundIrregularVertex(edge, end);
 		else if (isEndVertexRegular)
-			return computeNewVertexAroundIrregularVertex(edge, edge->start);
+			return computeNewVertexAroundIrregularVertex(edge, start);
 		else {
-			Vertex *v1 = computeNewVertexAroundIrregularVertex(edge, edge->start);
-			Vertex *v2 = computeNewVertexAroundIrregularVertex(edge, edge->end);
-			newVertexPosition = v1->position * (1.0f/2.0f) + v2->position * (1.0f/2.0f);
+			vec3 p1 = computeNewVertexAroundIrregularVertex(edge, start);
+			vec3 p2 = computeNewVertexAroundIrregularVertex(edge, end);
+			newVertexPosition = p1 * (1.0f/2.0f) + p2 * (1.0f/2.0f);
 		}
 	}
 
-	return new Vertex(newVertexPosition);
+	return newVertexPosition;
 }
 
 // Perform Butterfly subdivision
+// As in Loop subdivision, each pass writes straight into the arrays of the subdivided mesh.
 Mesh *Mesh::butterflySubdivision () {
 	Mesh *subdividedMesh = new Mesh();
-	map<string, Vertex*> edgeVertexMap;
-	Vertex *newVertex;
-
-	// Add existing vertices to subdividedMesh
-	for (int i = 1; i <= numVertices; i++) {
-		subdividedMesh->insertVertex(vertexMap[i]);
-	}
+	subdividedMesh->hasQuadrics = hasQuadrics;
+	subdividedMesh->resize(numVertices + numEdges, 2 * numEdges + 3 * numFaces, 4 * numFaces);
 
-	// Compute new mid point vertices for each edge
-	W_edge *edge;
-	for (map<string, W_edge*>::const_iterator it = edgeMap.begin(); it != edgeMap.end(); it++) {
-		edge = it->second;
+	vector<vec3> &newPositions = subdividedMesh->positions;
 
-		int startIndex = vertexIndexMap[edge->start];
-		int endIndex = vertexIndexMap[edge->end];
+	// Keep the existing vertices
+	std::copy(positions.begin(), positions.end(), newPositions.begin());
 
-		newVertex = computeMidpointButterfly(edge);
-		edgeVertexMap.insert(make_pair(getEdgeKey(startIndex, endIndex), newVertex));
-		subdividedMesh->insertVertex(newVertex);
+	// Compute new mid point vertices for each edge
+	#pragma omp parallel for schedule(dynamic, 1024)
+	for (int i = 1; i <= numEdges; i++) {
+		newPositions[numVertices + i] = computeMidpointButterfly(i);
 	}
 
 	// Finish by adding connections
-	Face *face;
-	Vertex *vertices[3];
-	for (int i = 1; i <= numFaces; i++) {
-		face = faceMap[i];
-		getAllVerticesForFace(face, vertices);
-
-		int a = vertexIndexMap[vertices[0]];
-		int b = vertexIndexMap[vertices[1]];
-		int c = vertexIndexMap[vertices[2]];
-
-		int p = subdividedMesh->vertexIndexMap[edgeVertexMap[getEdgeKey(a, b)]];
-		int q = subdividedMesh->vertexIndexMap[edgeVertexMap[getEdgeKey(b, c)]];
-		int r = subdividedMesh->vertexIndexMap[edgeVertexMap[getEdgeKey(c, a)]];
-
-		subdividedMesh->insertTriangle(a, p, r);
-		subdividedMesh->insertTriangle(b, q, p);
-		subdividedMesh->insertTriangle(c, r, q);
-		subdividedMesh->insertTriangle(p, q, r);
-	}
+	splitFaces(subdividedMesh);
 
 	return subdividedMesh;
 }
@@ -622,329 +1031,1850 @@ Mesh *Mesh::subdivideMesh (int subdivisionType, int subdivisionLevel) {
 	Mesh *subdividedMesh = this;
 
 	for (int i = 0; i < subdivisionLevel; i++) {
+		Mesh *nextMesh = subdividedMesh;
+
 		if (subdivisionType == LOOP)
-			subdividedMesh = subdividedMesh->loopSubdivision();
+			nextMesh = subdividedMesh->loopSubdivision();
 		else if (subdivisionType == BUTTERFLY)
-			subdividedMesh = subdividedMesh->butterflySubdivision();
+			nextMesh = subdividedMesh->butterflySubdivision();
+
+		// Intermediate levels are released as soon as the next one is built
+		if (subdividedMesh != this && subdividedMesh != nextMesh)
+			delete subdividedMesh;
+
+		subdividedMesh = nextMesh;
 	}
 
 	return subdividedMesh;
 }
 
+// Subdivision Stencils
+// The same rules as above, giving the vertices that make each new vertex and their weights
+// instead of its position. Both functions append to vertices and weights.
+
+// Append the Butterfly stencil around an irregular vertex, with its weights scaled by scale
+static void addIrregularButterflyStencil (Mesh *mesh, int edge, int vertex, float scale, vector<int> &vertices, vector<float> &weights) {
+	int k = mesh->getDegreeOfVertex(vertex);
+	bool hasTable = k <= MAX_WEIGHT_VALENCE;
+	float total_weights = 0;
+
+	int e = edge;
+	int nextVertex = mesh->getOtherVertex(edge, vertex);
+	for (int i = 0; i < k; i++) {
+		float s = hasTable ? subdivisionWeights.butterfly[k][i] : computeButterflyWeight(k, i);
+		total_weights += s;
+
+		if (i > 0) {
+			if (mesh->edgeStart[e] == vertex) {
+				nextVertex = mesh->getNextVertex(e, mesh->edgeLeftPrev[e]);
+				e = mesh->edgeLeftPrev[e];
+			} else {
+				nextVertex = mesh->getNextVertex(e, mesh->edgeRightNext[e]);
+				e = mesh->edgeRightNext[e];
+			}
+		}
+
+		vertices.push_back(nextVertex);
+		weights.push_back(scale * s);
+	}
+
+	vertices.push_back(vertex);
+	weights.push_back(scale * (hasTable ? subdivisionWeights.butterflyCentre[k] : 1 - total_weights));
+}
+
+// Stencil of the new position of an existing vertex
+void Mesh::getVertexStencil (int subdivisionType, int vertex, vector<int> &vertices, vector<float> &weights) {
+	if (subdivisionType != LOOP) {
+		vertices.push_back(vertex);
+		weights.push_back(1.0f);
+		return;
+	}
+
+	int k = getDegreeOfVertex(vertex);
+	float beta = (k <= MAX_WEIGHT_VALENCE) ? subdivisionWeights.beta[k] : computeBeta(k);
+
+	vertices.push_back(vertex);
+	weights.push_back(1.0f - k*beta);
+
+	int e = vertexEdge[vertex];
+	for (int i = 0; i < k; i++) {
+		if (edgeStart[e] == vertex) {
+			vertices.push_back(getNextVertex(e, edgeLeftPrev[e]));
+			e = edgeLeftPrev[e];
+		} else {
+			vertices.push_back(getNextVertex(e, edgeRightNext[e]));
+			e = edgeRightNext[e];
+		}
+
+		weights.push_back(beta);
+	}
+}
+
+// Stencil of the new vertex of an edge
+void Mesh::getMidpointStencil (int subdivisionType, int edge, vector<int> &vertices, vector<float> &weights) {
+	int start = edgeStart[edge];
+	int end = edgeEnd[edge];
+	int leftVertex = getNextVertex(edge, edgeLeftNext[edge]);
+	int rightVertex = getNextVertex(edge, edgeRightNext[edge]);
+
+	if (subdivisionType == LOOP) {
+		int stencilVertices[4] = {start, end, leftVertex, rightVertex};
+		float stencilWeights[4] = {3.0f/8.0f, 3.0f/8.0f, 1.0f/8.0f, 1.0f/8.0f};
+
+		vertices.insert(vertices.end(), stencilVertices, stencilVertices + 4);
+		weights.insert(weights.end(), stencilWeights, stencilWeights + 4);
+		return;
+	}
+
+	bool isStartVertexRegular = isRegular(start);
+	bool isEndVertexRegular = isRegular(end);
+
+	if (isStartVertexRegular && isEndVertexRegular) {
+		int stencilVertices[8] = {start, end, leftVertex, rightVertex};
+		float stencilWeights[8] = {1.0f/2.0f, 1.0f/2.0f, 1.0f/8.0f, 1.0f/8.0f, -1.0f/16.0f, -1.0f/16.0f, -1.0f/16.0f, -1.0f/16.0f};
+
+		getButterflyVertices(edge, stencilVertices + 4);
+
+		vertices.insert(vertices.end(), stencilVertices, stencilVertices + 8);
+		weights.insert(weights.end(), stencilWeights, stencilWeights + 8);
+	} else if (isStartVertexRegular) {
+		addIrregularButterflyStencil(this, edge, end, 1.0f, vertices, weights);
+	} else if (isEndVertexRegular) {
+		addIrregularButterflyStencil(this, edge, start, 1.0f, vertices, weights);
+	} else {
+		addIrregularButterflyStencil(this, edge, start, 1.0f/2.0f, vertices, weights);
+		addIrregularButterflyStencil(this, edge, end, 1.0f/2.0f, vertices, weights);
+	}
+}
+
 // Decimate a mesh
 
 // Compute Quadric for a face
-mat4 Mesh::getQuadric (Face *f, Vertex *v) {
-	vec3 faceNormal = getFaceNormal(f);
-	vec3 vertexPosition = v->position;
+Quadric Mesh::getQuadric (int f, int v) {
+	vec3 faceNormal = faceNormals[f];
+	vec3 vertexPosition = positions[v];
 
 	float d = -dot(faceNormal, vertexPosition);
 
 	vec4 p = vec4(faceNormal, d);
 
-	return outerProduct(p, p);
+	return Quadric(p);
 }
 
 // Update the vertex Quadric for vertex v1 by adding the face Quadric
-void Mesh::updateQuadricForVertex (Face *f, int v1) {
-	Vertex *vertex = vertexMap[v1];
-	vertex->quadric += getQuadric(f, vertex);
+void Mesh::updateQuadricForVertex (int f, int v1) {
+	quadrics[v1] += getQuadric(f, v1);
 }
 
 // Update the vertex Quadric for each vertex v1, v2 and v3
-void Mesh::updateQuadricForEachVertex (Face *f, int v1, int v2, int v3) {
+void Mesh::updateQuadricForEachVertex (int f, int v1, int v2, int v3) {
+	if (!hasQuadrics)
+		return;
+
 	updateQuadricForVertex(f, v1);
 	updateQuadricForVertex(f, v2);
 	updateQuadricForVertex(f, v3);
 }
 
-// Inner Optimization: Compute the new vertex position for an edge collapse
-vec4 Mesh::computeNewVertexPositionForEdgeCollapse (W_edge *edge) {
-	mat4 quadric = edge->start->quadric + edge->end->quadric;
+// Compute the Quadric of the plane of a face through its current corners
+// Edge collapses leave faceNormals as the mesh was built, so the plane is not taken from there.
+// A degenerate face has no plane and adds nothing.
+static Quadric getCurrentFaceQuadric (Mesh *mesh, int f) {
+	int vertices[3];
+	mesh->getAllVerticesForFace(f, vertices);
 
-	quadric[0][3] = 0;
-	quadric[1][3] = 0;
-	quadric[2][3] = 0;
-	quadric[3][3] = 1;
+	vec3 p1 = mesh->positions[vertices[0]];
+	vec3 normal = cross(mesh->positions[vertices[1]] - p1, mesh->positions[vertices[2]] - p1);
+	float length = glm::length(normal);
 
-	vec4 vec = vec4(0.0f, 0.0f, 0.0f, 1.0f);
+	if (length == 0.0f)
+		return Quadric();
 
-	return inverse(quadric) * vec;
+	normal /= length;
+	return Quadric(vec4(normal, -dot(normal, p1)));
 }
 
-// Compute the error for the new vertex position
-float getError (W_edge *edge, vec4 p) {
-	mat4 Q = edge->start->quadric + edge->end->quadric;
-	return dot(p*Q, p); 	
+// Sum the quadrics of the faces around a vertex as they are now
+Quadric Mesh::getVertexQuadric (int v) {
+	Quadric quadric;
+
+	int e1 = vertexEdge[v];
+	if (e1 == 0)
+		return quadric;
+
+	int e = e1;
+	do {
+		if (edgeStart[e] == v) {
+			quadric += getCurrentFaceQuadric(this, edgeLeft[e]);
+			e = edgeLeftPrev[e];
+		} else {
+			quadric += getCurrentFaceQuadric(this, edgeRight[e]);
+			e = edgeRightNext[e];
+		}
+	} while (e != e1);
+
+	return quadric;
 }
 
-// Get a candidate edge to collapse among k randomly selected edges
-W_edge *Mesh::getCandidateEdgeToCollapse (int k, map<W_edge*, bool> flagged) {
-	std::random_device rd; //Will be used to obtain a seed for the random number engine
-	std::mt19937 gen(rd()); //Standard mersenne_twister_engine seeded with rd()
-	std::uniform_int_distribution<> dis(1, numEdges);
+// Check if edge collapses are scored from the faces around them rather than from the stored quadrics
+bool Mesh::usesLocalCosts () {
+	return !hasQuadrics || collapseType == MEMORYLESS_COLLAPSE;
+}
 
-	float minError = FLT_MAX;
-	W_edge *candidateEdge;
+// Weight of the triangle shape term of a memoryless collapse, relative to the mean volume term
+// Small, so that it only settles the position along directions the volumes leave free
+#define SHAPE_WEIGHT 1e-3f
 
-	for(int i = 0; i < k; i++) {
-		W_edge *edge;
-		do {
-			int edgeIndex = dis(gen);
-			string edgeKey = edgeKeyMap[edgeIndex];
-			edge = edgeMap[edgeKey];
-		} while (flagged[edge]); // Select a new edge if the edge is flagged
+// Add the volume quadrics of the triangles (vertex, ring[i], ring[i + 1]) that do not contain the
+// vertex skip, relative to origin, and the normal and offset of the plane that preserves their volume
+// Moving the vertex to v sweeps a volume dot(n, v - p) / 6 for the unnormalized normal n of each
+// triangle, so the quadric is the sum of the squared volumes.
+static void addVolumeQuadrics (Mesh *mesh, int vertex, const int *ring, int count, int skip, vec3 origin, Quadric &quadric, vec3 &normal, float &offset) {
+	vec3 p = mesh->positions[vertex] - origin;
 
-		vec4 newVertexPosition = computeNewVertexPositionForEdgeCollapse(edge);
+	for (int i = 0; i < count; i++) {
+		int a = ring[i];
+		int b = ring[(i + 1) % count];
 
-		float error = getError(edge, newVertexPosition);
+		if (a == skip || b == skip)
+			continue;
 
-		if (error < minError) {
-			minError = error;
-			candidateEdge = edge;
-		}
+		vec3 n = cross(mesh->positions[a] - origin - p, mesh->positions[b] - origin - p);
+		float d = dot(n, p);
+
+		quadric += Quadric(vec4(n, -d) / 6.0f);
+		normal = normal + n;
+		offset += d;
 	}
+}
 
-	return candidateEdge;
+// Add the triangle shape quadric, the squared distances to the ring vertices other than skip,
+// relative to origin and times weight
+static void addShapeQuadrics (Mesh *mesh, const int *ring, int count, int skip, vec3 origin, float weight, Quadric &quadric) {
+	for (int i = 0; i < count; i++) {
+		if (ring[i] == skip)
+			continue;
+
+		vec3 r = mesh->positions[ring[i]] - origin;
+
+		quadric.q[0] += weight;
+		quadric.q[4] += weight;
+		quadric.q[7] += weight;
+		quadric.q[3] -= weight * r.x;
+		quadric.q[6] -= weight * r.y;
+		quadric.q[8] -= weight * r.z;
+		quadric.q[9] += weight * dot(r, r);
+	}
 }
 
-// Check if the edge collapse can cause a mesh foldover
-bool Mesh::canCauseFoldOver (W_edge *edge) {
-	vec3 newVertexPosition(computeNewVertexPositionForEdgeCollapse(edge));
-	Vertex *newVertex = new Vertex(newVertexPosition);
+// Build the memoryless quadric of an edge collapse from the faces around both end points, relative
+// to the start point, as in Lindstrom and Turk's memoryless simplification
+// The quadric sums the squared volumes swept by the faces plus a small triangle shape term, and
+// the plane dot(normal, v) = offset keeps the volume they enclose. Returns false if an end point
+// has more than MAX_RING_SIZE neighbours.
+static bool getLocalQuadric (Mesh *mesh, int edge, Quadric &quadric, vec3 &normal, float &offset) {
+	int start = mesh->edgeStart[edge];
+	int end = mesh->edgeEnd[edge];
 
-	W_edge *e = edge->left_next;
+	int startRing[MAX_RING_SIZE], endRing[MAX_RING_SIZE];
+	int startCount = mesh->getRing(start, startRing, MAX_RING_SIZE);
+	int endCount = mesh->getRing(end, endRing, MAX_RING_SIZE);
 
-	while (e != edge->right_next) {
-		W_edge *other;
-		if (e->start == edge->end) {
-			other = e->right_next;
-			e = e->right_prev;
-		} else {
-			other = e->left_prev;
-			e = e->left_next;
-		}
+	if (startCount < 0 || endCount < 0)
+		return false;
 
-		vec3 oldNormal = getFaceNormalVector(edge->end, other->start, other->end);
-		vec3 newNormal = getFaceNormalVector(newVertex, other->start, other->end);
+	vec3 origin = mesh->positions[start];
+	quadric = Quadric();
+	normal = vec3(0.0);
+	offset = 0.0f;
 
-		if (dot(oldNormal, newNormal) < 0) {
-			return true;
-		}
-	}
+	// The two faces of the edge are around both end points, so they are added once
+	addVolumeQuadrics(mesh, start, startRing, startCount, 0, origin, quadric, normal, offset);
+	addVolumeQuadrics(mesh, end, endRing, endCount, start, origin, quadric, normal, offset);
 
-	e = edge->right_prev;
+	float weight = SHAPE_WEIGHT * (quadric.q[0] + quadric.q[4] + quadric.q[7]) / (startCount + endCount);
+	addShapeQuadrics(mesh, startRing, startCount, end, origin, weight, quadric);
+	addShapeQuadrics(mesh, endRing, endCount, start, origin, weight, quadric);
 
-	while (e != edge->left_prev) {
-		W_edge *other;
-		if (e->start == edge->start) {
-			other = e->right_next;
-			e = e->right_prev;
-		} else {
-			other = e->left_prev;
-			e = e->left_next;
-		}
+	return true;
+}
 
-		vec3 oldNormal = getFaceNormalVector(edge->start, other->start, other->end);
-		vec3 newNormal = getFaceNormalVector(newVertex, other->start, other->end);
+// Compute the new vertex position and its error for a memoryless edge collapse
+// The position keeps the volume and, within that, minimizes the quadric; a half edge collapse takes
+// the end point of least error instead.
+static void evaluateLocalCollapse (Mesh *mesh, int edge, vec3 &newPosition, float &error) {
+	vec3 origin = mesh->positions[mesh->edgeStart[edge]];
+	vec3 end = mesh->positions[mesh->edgeEnd[edge]] - origin;
+
+	Quadric quadric;
+	vec3 normal;
+	float offset;
+
+	if (!getLocalQuadric(mesh, edge, quadric, normal, offset)) {
+		newPosition = origin + end * 0.5f;
+		error = FLT_MAX;
+		return;
+	}
 
-		if (dot(oldNormal, newNormal) < 0) {
-			return true;
+	vec3 v;
+	if (mesh->collapseType == HALF_EDGE_COLLAPSE)
+		v = quadric.getEndpointPosition(vec3(0.0), end);
+	else if (!quadric.optimize(v, normal, offset))
+		v = quadric.getCollapsePosition(vec3(0.0), end);
+
+	newPosition = origin + v;
+	error = quadric.evaluate(v);
+}
+
+// Inner Optimization: Compute the new vertex position for an edge collapse
+vec3 Mesh::computeNewVertexPositionForEdgeCollapse (int edge) {
+	int start = edgeStart[edge];
+	int end = edgeEnd[edge];
+
+	if (usesLocalCosts()) {
+		vec3 newPosition;
+		float error;
+		evaluateLocalCollapse(this, edge, newPosition, error);
+		return newPosition;
+	}
+
+	Quadric quadric = quadrics[start] + quadrics[end];
+
+	if (collapseType == HALF_EDGE_COLLAPSE)
+		return quadric.getEndpointPosition(positions[start], positions[end]);
+
+	return quadric.getCollapsePosition(positions[start], positions[end]);
+}
+
+// Compute the error for the new vertex position
+float Mesh::getError (int edge, vec3 p) {
+	if (usesLocalCosts()) {
+		Quadric quadric;
+		vec3 normal;
+		float offset;
+
+		if (!getLocalQuadric(this, edge, quadric, normal, offset))
+			return FLT_MAX;
+		return quadric.evaluate(p - positions[edgeStart[edge]]);
+	}
+
+	Quadric quadric = quadrics[edgeStart[edge]] + quadrics[edgeEnd[edge]];
+	return quadric.evaluate(p);
+}
+
+// Compute the new vertex position and its error for each of the n edges
+void Mesh::evaluateEdgeCollapses (int n, const int *edges, vec3 *newPositions, float *errors) {
+	for (int i = 0; i < n; i++) {
+		if (usesLocalCosts()) {
+			evaluateLocalCollapse(this, edges[i], newPositions[i], errors[i]);
+			continue;
+		}
+
+		int start = edgeStart[edges[i]];
+		int end = edgeEnd[edges[i]];
+
+		Quadric quadric = quadrics[start] + quadrics[end];
+
+		// A half edge collapse needs no solve, only the errors at both end points
+		if (collapseType == HALF_EDGE_COLLAPSE) {
+			float startError = quadric.evaluate(positions[start]);
+			float endError = quadric.evaluate(positions[end]);
+
+			newPositions[i] = (startError <= endError) ? positions[start] : positions[end];
+			errors[i] = std::min(startError, endError);
+			continue;
+		}
+
+		newPositions[i] = quadric.getCollapsePosition(positions[start], positions[end]);
+		errors[i] = quadric.evaluate(newPositions[i]);
+	}
+}
+
+// Seed the random edge selection of the multiple choice decimation, for reproducible results
+void Mesh::seedDecimation (unsigned int seed) {
+	sampler.seed(seed);
+}
+
+// Get a candidate edge to collapse among k randomly selected edges
+// Flagged edges are never selected; returns 0 if every edge is flagged
+int Mesh::getCandidateEdgeToCollapse (int k) {
+	if (sampler.size() == 0)
+		return 0;
+
+	// The buffers keep their capacity, so drawing allocates nothing after the first call
+	candidateEdges.resize(k);
+	candidatePositions.resize(k);
+	candidateErrors.resize(k);
+
+	for(int i = 0; i < k; i++) {
+		candidateEdges[i] = sampler.sample();
+	}
+
+	evaluateEdgeCollapses(k, &candidateEdges[0], &candidatePositions[0], &candidateErrors[0]);
+
+	float minError = FLT_MAX;
+	int candidateEdge = candidateEdges[0];
+
+	for(int i = 0; i < k; i++) {
+		if (candidateErrors[i] < minError) {
+			minError = candidateErrors[i];
+			candidateEdge = candidateEdges[i];
 		}
 	}
 
+	return candidateEdge;
+}
+
+// Gather the neighbours of a vertex in rotational order into ring
+// Returns their number, or -1 if there are more than maxSize
+int Mesh::getRing (int vertex, int *ring, int maxSize) {
+	int e1 = vertexEdge[vertex];
+	int e = e1;
+	int count = 0;
+
+	do {
+		if (count == maxSize)
+			return -1;
+
+		if (edgeStart[e] == vertex) {
+			ring[count++] = edgeEnd[e];
+			e = edgeLeftPrev[e];
+		} else {
+			ring[count++] = edgeStart[e];
+			e = edgeRightNext[e];
+		}
+	} while (e != e1);
+
+	return count;
+}
+
+// Check if moving a vertex to newPosition flips one of the triangles (vertex, ring[i], ring[i + 1])
+// that do not contain the vertex skip
+// The corners are copied into flat arrays so that the sign tests on the unnormalized normals run
+// as one vector loop.
+static bool canFlipTriangles (Mesh *mesh, int vertex, const int *ring, int count, int skip, vec3 newPosition) {
+	float ax[MAX_RING_SIZE], ay[MAX_RING_SIZE], az[MAX_RING_SIZE];
+	float bx[MAX_RING_SIZE], by[MAX_RING_SIZE], bz[MAX_RING_SIZE];
+	int n = 0;
+
+	for (int i = 0; i < count; i++) {
+		int a = ring[i];
+		int b = ring[i + 1 < count ? i + 1 : 0];
+
+		if (a == skip || b == skip)
+			continue;
+
+		vec3 pa = mesh->positions[a];
+		vec3 pb = mesh->positions[b];
+		ax[n] = pa.x; ay[n] = pa.y; az[n] = pa.z;
+		bx[n] = pb.x; by[n] = pb.y; bz[n] = pb.z;
+		n++;
+	}
+
+	vec3 p = mesh->positions[vertex];
+	vec3 q = newPosition;
+	int flipped = 0;
+
+	#pragma omp simd reduction(|:flipped)
+	for (int i = 0; i < n; i++) {
+		// Normal (a - p) x (b - p) of the triangle before the move
+		float u0 = ax[i] - p.x, u1 = ay[i] - p.y, u2 = az[i] - p.z;
+		float v0 = bx[i] - p.x, v1 = by[i] - p.y, v2 = bz[i] - p.z;
+		float n0 = u1 * v2 - u2 * v1, n1 = u2 * v0 - u0 * v2, n2 = u0 * v1 - u1 * v0;
+
+		// and after it
+		float s0 = ax[i] - q.x, s1 = ay[i] - q.y, s2 = az[i] - q.z;
+		float t0 = bx[i] - q.x, t1 = by[i] - q.y, t2 = bz[i] - q.z;
+		float m0 = s1 * t2 - s2 * t1, m1 = s2 * t0 - s0 * t2, m2 = s0 * t1 - s1 * t0;
+
+		flipped |= (n0 * m0 + n1 * m1 + n2 * m2 < 0);
+	}
+
+	return flipped != 0;
+}
+
+// Check if the end points of an edge, with the given rings, share a neighbour besides the two
+// vertices opposite the edge (the link condition)
+// The neighbours of the start are marked with a new generation, so no marks need clearing.
+static bool violatesLinkCondition (Mesh *mesh, int edge, const int *startRing, int startCount, const int *endRing, int endCount, vector<unsigned int> &marks, unsigned int &mark) {
+	int leftWing = mesh->getNextVertex(edge, mesh->edgeLeftNext[edge]);
+	int rightWing = mesh->getNextVertex(edge, mesh->edgeRightNext[edge]);
+
+	if (marks.size() < (size_t) mesh->numVertices + 1)
+		marks.resize(mesh->numVertices + 1, 0);
+
+	if (++mark == 0) {
+		std::fill(marks.begin(), marks.end(), 0);
+		mark = 1;
+	}
+
+	for (int i = 0; i < startCount; i++) {
+		marks[startRing[i]] = mark;
+	}
+
+	for (int i = 0; i < endCount; i++) {
+		int v = endRing[i];
+		if (v != leftWing && v != rightWing && marks[v] == mark)
+			return true;
+	}
+
 	return false;
 }
 
+// Check if the edge collapse can cause a mesh foldover
+bool Mesh::canCauseFoldOver (int edge) {
+	int start = edgeStart[edge];
+	int end = edgeEnd[edge];
+
+	int startRing[MAX_RING_SIZE], endRing[MAX_RING_SIZE];
+	int startCount = getRing(start, startRing, MAX_RING_SIZE);
+	int endCount = getRing(end, endRing, MAX_RING_SIZE);
+
+	if (startCount < 0 || endCount < 0)
+		return true;
+
+	vec3 newVertexPosition(computeNewVertexPositionForEdgeCollapse(edge));
+
+	return canFlipTriangles(this, end, endRing, endCount, start, newVertexPosition)
+		|| canFlipTriangles(this, start, startRing, startCount, end, newVertexPosition);
+}
+
 // Check if the edge collapse can cause a non-manifold mesh
-bool Mesh::canCauseNonManifoldMesh (W_edge *edge) {
-	Vertex *leftNext = getNextVertex(edge, edge->left_next);
-	Vertex *rightNext = getNextVertex(edge, edge->right_next);
-	return getDegreeOfVertex(leftNext) == 3 || getDegreeOfVertex(rightNext) == 3;
+// Besides the two vertices opposite the edge, the end points must not share a neighbour (the link
+// condition), or the collapse would fold two faces onto each other. Collapsing an edge between two
+// vertices of valence 3 (a tetrahedron) would leave a degenerate vertex.
+bool Mesh::canCauseNonManifoldMesh (int edge) {
+	int start = edgeStart[edge];
+	int end = edgeEnd[edge];
+
+	if (valences[start] > MAX_RING_SIZE || valences[end] > MAX_RING_SIZE || (valences[start] == 3 && valences[end] == 3))
+		return true;
+
+	int startRing[MAX_RING_SIZE], endRing[MAX_RING_SIZE];
+	int startCount = getRing(start, startRing, MAX_RING_SIZE);
+	int endCount = getRing(end, endRing, MAX_RING_SIZE);
+
+	return violatesLinkCondition(this, edge, startRing, startCount, endRing, endCount, vertexMarks, vertexMark);
 }
 
-// Collapse the edge
-void Mesh::collapseEdge (W_edge *edge) {
-	vec3 newVertexPosition(computeNewVertexPositionForEdgeCollapse(edge));
+// Check if an edge can be collapsed without folding over or making the mesh non-manifold, with the
+// remaining vertex at newPosition, or where it would go if newPosition is NULL
+// Both rings are gathered once on the stack, and the cheap topological test runs first.
+// Vertices of valence above MAX_RING_SIZE are never collapsed. The link condition uses the given
+// vertex marks, so threads with their own marks may check collapses at the same time.
+static bool isCollapseValid (Mesh *mesh, int edge, const vec3 *newPosition, vector<unsigned int> &marks, unsigned int &mark) {
+	int start = mesh->edgeStart[edge];
+	int end = mesh->edgeEnd[edge];
+
+	// The valences rule out the same cases as the ring sizes, before the rings are walked
+	if (mesh->valences[start] > MAX_RING_SIZE || mesh->valences[end] > MAX_RING_SIZE || (mesh->valences[start] == 3 && mesh->valences[end] == 3))
+		return false;
+
+	int startRing[MAX_RING_SIZE], endRing[MAX_RING_SIZE];
+	int startCount = mesh->getRing(start, startRing, MAX_RING_SIZE);
+	int endCount = mesh->getRing(end, endRing, MAX_RING_SIZE);
 
-	Vertex *startVertex = edge->start;
-	startVertex->position = newVertexPosition;
-	startVertex->quadric += edge->end->quadric;
+	if (violatesLinkCondition(mesh, edge, startRing, startCount, endRing, endCount, marks, mark))
+		return false;
 
-	W_edge *leftNext = edge->left_next;
-	W_edge *rightNext = edge->right_next;
-	W_edge *leftPrev = edge->left_prev;
-	W_edge *rightPrev = edge->right_prev;
+	vec3 newVertexPosition(newPosition != NULL ? *newPosition : mesh->computeNewVertexPositionForEdgeCollapse(edge));
+
+	return !canFlipTriangles(mesh, end, endRing, endCount, start, newVertexPosition)
+		&& !canFlipTriangles(mesh, start, startRing, startCount, end, newVertexPosition);
+}
+
+// Check if an edge can be collapsed without folding over or making the mesh non-manifold
+// Uses the vertex marks of the mesh, so only one thread may check collapses at a time.
+bool Mesh::canCollapseEdge (int edge) {
+	return isCollapseValid(this, edge, NULL, vertexMarks, vertexMark);
+}
+
+// Save what collapsing the edge overwrites
+static void saveCollapseInverse (Mesh *mesh, int edge, CollapseInverse &inverse) {
+	int start = mesh->edgeStart[edge];
+	int end = mesh->edgeEnd[edge];
+	int left = mesh->edgeLeft[edge];
+	int right = mesh->edgeRight[edge];
+	int leftNext = mesh->edgeLeftNext[edge];
+	int rightNext = mesh->edgeRightNext[edge];
+
+	// The edges next to leftNext and rightNext in the faces beyond them are rewired
+	bool isLeftOfLeftNext = (mesh->edgeLeft[leftNext] == left);
+	bool isLeftOfRightNext = (mesh->edgeLeft[rightNext] == right);
+
+	int edges[9] = {
+		edge, leftNext, rightNext, mesh->edgeLeftPrev[edge], mesh->edgeRightPrev[edge],
+		isLeftOfLeftNext ? mesh->edgeRightPrev[leftNext] : mesh->edgeLeftPrev[leftNext],
+		isLeftOfLeftNext ? mesh->edgeRightNext[leftNext] : mesh->edgeLeftNext[leftNext],
+		isLeftOfRightNext ? mesh->edgeRightPrev[rightNext] : mesh->edgeLeftPrev[rightNext],
+		isLeftOfRightNext ? mesh->edgeRightNext[rightNext] : mesh->edgeLeftNext[rightNext]
+	};
+
+	inverse.edge = edge;
+
+	for (int i = 0; i < 9; i++) {
+		int e = edges[i];
+		int *links = inverse.edgeLinks[i];
+
+		inverse.edges[i] = e;
+		links[0] = mesh->edgeStart[e];
+		links[1] = mesh->edgeEnd[e];
+		links[2] = mesh->edgeLeft[e];
+		links[3] = mesh->edgeRight[e];
+		links[4] = mesh->edgeLeftPrev[e];
+		links[5] = mesh->edgeLeftNext[e];
+		links[6] = mesh->edgeRightPrev[e];
+		links[7] = mesh->edgeRightNext[e];
+	}
+
+	inverse.faces[0] = left;
+	inverse.faces[1] = right;
+	inverse.faces[2] = isLeftOfLeftNext ? mesh->edgeRight[leftNext] : mesh->edgeLeft[leftNext];
+	inverse.faces[3] = isLeftOfRightNext ? mesh->edgeRight[rightNext] : mesh->edgeLeft[rightNext];
+
+	for (int i = 0; i < 4; i++)
+		inverse.faceEdges[i] = mesh->faceEdge[inverse.faces[i]];
+
+	inverse.faceNormals[0] = mesh->faceNormals[left];
+	inverse.faceNormals[1] = mesh->faceNormals[right];
+
+	inverse.vertices[0] = start;
+	inverse.vertices[1] = end;
+	inverse.vertices[2] = mesh->getOtherVertex(leftNext, end);
+	inverse.vertices[3] = mesh->getOtherVertex(rightNext, end);
+
+	for (int i = 0; i < 4; i++)
+		inverse.vertexEdges[i] = mesh->vertexEdge[inverse.vertices[i]];
+
+	inverse.positions[0] = mesh->positions[start];
+	inverse.positions[1] = mesh->positions[end];
+	inverse.removedNormal = mesh->normals[end];
+	if (mesh->hasQuadrics) {
+		inverse.quadrics[0] = mesh->quadrics[start];
+		inverse.quadrics[1] = mesh->quadrics[end];
+	}
+}
+
+// Relink the mesh around a collapsing edge: move its start point to newVertexPosition and give it
+// the edges of the end point
+// The edge, the two edges and two faces beside it and the end point are left unlinked for the caller
+// to delete. Everything written lies within one edge of the end points, and the edge map is updated
+// only if updateEdgeMap is set.
+void Mesh::relinkEdgeCollapse (int edge, vec3 newVertexPosition, bool updateEdgeMap) {
+	int start = edgeStart[edge];
+	int end = edgeEnd[edge];
+	int left = edgeLeft[edge];
+	int right = edgeRight[edge];
+
+	positions[start] = newVertexPosition;
+	if (hasQuadrics)
+		quadrics[start] += quadrics[end];
+
+	int leftNext = edgeLeftNext[edge];
+	int rightNext = edgeRightNext[edge];
+	int leftPrev = edgeLeftPrev[edge];
+	int rightPrev = edgeRightPrev[edge];
+
+	// The start point takes the edges of the end point but the edge and the two deleted with it,
+	// and the vertices opposite the edge lose one each
+	valences[start] += valences[end] - 4;
+	valences[getOtherVertex(leftNext, end)]--;
+	valences[getOtherVertex(rightNext, end)]--;
 
 	// Update vertex references
-	W_edge *e = leftNext;
+	int e = leftNext;
 	while (e != rightNext) {
-		if (e->start == edge->end || e->start == edge->start) {
-			e = e->right_prev;
+		if (edgeStart[e] == end || edgeStart[e] == start) {
+			e = edgeRightPrev[e];
 		} else {
-			e = e->left_next;
+			e = edgeLeftNext[e];
 		}
 
-		if (e->start == edge->end) {
-			e->start = edge->start;
+		if (updateEdgeMap)
+			edgeMap.erase(getEdgeKey(edgeStart[e], edgeEnd[e]));
+
+		if (edgeStart[e] == end) {
+			edgeStart[e] = start;
 		} else {
-			e->end = edge->start;
+			edgeEnd[e] = start;
 		}
+
+		// rightNext is removed below and would clash with the key of rightPrev
+		if (updateEdgeMap && e != rightNext)
+			edgeMap.insert(getEdgeKey(edgeStart[e], edgeEnd[e]), e);
 	}
 
 	// Update edge references
-	if (leftNext->left == edge->left) {
-		if (leftPrev->left == edge->left) {
-			leftPrev->left_next = leftNext->right_prev;
-			leftPrev->left_prev = leftNext->right_next;
+	if (edgeLeft[leftNext] == left) {
+		if (edgeLeft[leftPrev] == left) {
+			edgeLeftNext[leftPrev] = edgeRightPrev[leftNext];
+			edgeLeftPrev[leftPrev] = edgeRightNext[leftNext];
 		} else {
-			leftPrev->right_prev = leftNext->right_prev;
-			leftPrev->right_next = leftNext->right_next;
+			edgeRightPrev[leftPrev] = edgeRightPrev[leftNext];
+			edgeRightNext[leftPrev] = edgeRightNext[leftNext];
 		}
 
-		if (leftNext->right_prev->right_next == leftNext) {
-			leftNext->right_prev->right_next = leftPrev;
+		int prev = edgeRightPrev[leftNext];
+		if (edgeRightNext[prev] == leftNext) {
+			edgeRightNext[prev] = leftPrev;
 		} else {
-			leftNext->right_prev->left_prev = leftPrev;
+			edgeLeftPrev[prev] = leftPrev;
 		}
 
-		if (leftNext->right_next->right_prev == leftNext) {
-			leftNext->right_next->right_prev = leftPrev;
+		int next = edgeRightNext[leftNext];
+		if (edgeRightPrev[next] == leftNext) {
+			edgeRightPrev[next] = leftPrev;
 		} else {
-			leftNext->right_next->left_next = leftPrev;
+			edgeLeftNext[next] = leftPrev;
 		}
 	} else {
-		if (leftPrev->left == edge->left) {
-			leftPrev->left_next = leftNext->left_next;
-			leftPrev->left_prev = leftNext->left_prev;
+		if (edgeLeft[leftPrev] == left) {
+			edgeLeftNext[leftPrev] = edgeLeftNext[leftNext];
+			edgeLeftPrev[leftPrev] = edgeLeftPrev[leftNext];
 		} else {
-			leftPrev->right_prev = leftNext->left_next;
-			leftPrev->right_next = leftNext->left_prev;
+			edgeRightPrev[leftPrev] = edgeLeftNext[leftNext];
+			edgeRightNext[leftPrev] = edgeLeftPrev[leftNext];
 		}
 
-		if (leftNext->left_next->left_prev == leftNext) {
-			leftNext->left_next->left_prev = leftPrev;
+		int next = edgeLeftNext[leftNext];
+		if (edgeLeftPrev[next] == leftNext) {
+			edgeLeftPrev[next] = leftPrev;
 		} else {
-			leftNext->left_next->right_next = leftPrev;
+			edgeRightNext[next] = leftPrev;
 		}
 
-		if (leftNext->left_prev->left_next == leftNext) {
-			leftNext->left_prev->left_next = leftPrev;
+		int prev = edgeLeftPrev[leftNext];
+		if (edgeLeftNext[prev] == leftNext) {
+			edgeLeftNext[prev] = leftPrev;
 		} else {
-			leftNext->left_prev->right_prev = leftPrev;
+			edgeRightPrev[prev] = leftPrev;
 		}
 	}
 
-	if (rightNext->left == edge->right) {
-		if (rightPrev->left == edge->right) {
-			rightPrev->left_next = rightNext->right_prev;
-			rightPrev->left_prev = rightNext->right_next;
+	if (edgeLeft[rightNext] == right) {
+		if (edgeLeft[rightPrev] == right) {
+			edgeLeftNext[rightPrev] = edgeRightPrev[rightNext];
+			edgeLeftPrev[rightPrev] = edgeRightNext[rightNext];
 		} else {
-			rightPrev->right_prev = rightNext->right_prev;
-			rightPrev->right_next = rightNext->right_next;
+			edgeRightPrev[rightPrev] = edgeRightPrev[rightNext];
+			edgeRightNext[rightPrev] = edgeRightNext[rightNext];
 		}
 
-		if (rightNext->right_prev->right_next == rightNext) {
-			rightNext->right_prev->right_next = rightPrev;
+		int prev = edgeRightPrev[rightNext];
+		if (edgeRightNext[prev] == rightNext) {
+			edgeRightNext[prev] = rightPrev;
 		} else {
-			rightNext->right_prev->left_prev = rightPrev;
+			edgeLeftPrev[prev] = rightPrev;
 		}
 
-		if (rightNext->right_next->right_prev == rightNext) {
-			rightNext->right_next->right_prev = rightPrev;
+		int next = edgeRightNext[rightNext];
+		if (edgeRightPrev[next] == rightNext) {
+			edgeRightPrev[next] = rightPrev;
 		} else {
-			rightNext->right_next->left_next = rightPrev;
+			edgeLeftNext[next] = rightPrev;
 		}
 	} else {
-		if (rightPrev->left == edge->right) {
-			rightPrev->left_next = rightNext->left_next;
-			rightPrev->left_prev = rightNext->left_prev;
+		if (edgeLeft[rightPrev] == right) {
+			edgeLeftNext[rightPrev] = edgeLeftNext[rightNext];
+			edgeLeftPrev[rightPrev] = edgeLeftPrev[rightNext];
 		} else {
-			rightPrev->right_prev = rightNext->left_next;
-			rightPrev->right_next = rightNext->left_prev;
+			edgeRightPrev[rightPrev] = edgeLeftNext[rightNext];
+			edgeRightNext[rightPrev] = edgeLeftPrev[rightNext];
 		}
 
-		if (rightNext->left_next->left_prev == rightNext) {
-			rightNext->left_next->left_prev = rightPrev;
+		int next = edgeLeftNext[rightNext];
+		if (edgeLeftPrev[next] == rightNext) {
+			edgeLeftPrev[next] = rightPrev;
 		} else {
-			rightNext->left_next->right_next = rightPrev;
+			edgeRightNext[next] = rightPrev;
 		}
 
-		if (rightNext->left_prev->left_next == rightNext) {
-			rightNext->left_prev->left_next = rightPrev;
+		int prev = edgeLeftPrev[rightNext];
+		if (edgeLeftNext[prev] == rightNext) {
+			edgeLeftNext[prev] = rightPrev;
 		} else {
-			rightNext->left_prev->right_prev = rightPrev;
+			edgeRightPrev[prev] = rightPrev;
 		}
 	}
 
 	// Update face references and edge references for the faces
-	if (leftNext->left == edge->left) {
-		if (leftPrev->left == edge->left) {
-			leftPrev->left = leftNext->right;
+	if (edgeLeft[leftNext] == left) {
+		if (edgeLeft[leftPrev] == left) {
+			edgeLeft[leftPrev] = edgeRight[leftNext];
 		} else {
-			leftPrev->right = leftNext->right;
+			edgeRight[leftPrev] = edgeRight[leftNext];
 		}
-		leftNext->right->edge = leftPrev;
+		faceEdge[edgeRight[leftNext]] = leftPrev;
 	} else {
-		if (leftPrev->left == edge->left) {
-			leftPrev->left = leftNext->left;
+		if (edgeLeft[leftPrev] == left) {
+			edgeLeft[leftPrev] = edgeLeft[leftNext];
 		} else {
-			leftPrev->right = leftNext->left;
+			edgeRight[leftPrev] = edgeLeft[leftNext];
 		}
-		leftNext->left->edge = leftPrev;
+		faceEdge[edgeLeft[leftNext]] = leftPrev;
 	}
 
-	if (rightNext->left == edge->right) {
-		if (rightPrev->left == edge->right) {
-			rightPrev->left = rightNext->right;
+	if (edgeLeft[rightNext] == right) {
+		if (edgeLeft[rightPrev] == right) {
+			edgeLeft[rightPrev] = edgeRight[rightNext];
 		} else {
-			rightPrev->right = rightNext->right;
+			edgeRight[rightPrev] = edgeRight[rightNext];
 		}
-		rightNext->right->edge = rightPrev;
+		faceEdge[edgeRight[rightNext]] = rightPrev;
 	} else {
-		if (rightPrev->left == edge->right) {
-			rightPrev->left = rightNext->left;
+		if (edgeLeft[rightPrev] == right) {
+			edgeLeft[rightPrev] = edgeLeft[rightNext];
 		} else {
-			rightPrev->right = rightNext->left;
+			edgeRight[rightPrev] = edgeLeft[rightNext];
 		}
-		rightNext->left->edge = rightPrev;
+		faceEdge[edgeLeft[rightNext]] = rightPrev;
 	}
 
 	// Update edge reference for the vertices
-	edge->start->edge = leftPrev;
-	if (leftNext->left == edge->left) {
-		leftNext->end->edge = leftPrev;
+	vertexEdge[start] = leftPrev;
+	if (edgeLeft[leftNext] == left) {
+		vertexEdge[edgeEnd[leftNext]] = leftPrev;
 	} else {
-		leftNext->start->edge = leftPrev;
+		vertexEdge[edgeStart[leftNext]] = leftPrev;
 	}
 
-	if (rightNext->left == edge->right) {
-		rightNext->start->edge = rightPrev;
+	if (edgeLeft[rightNext] == right) {
+		vertexEdge[edgeStart[rightNext]] = rightPrev;
 	} else {
-		rightNext->end->edge = rightPrev;
+		vertexEdge[edgeEnd[rightNext]] = rightPrev;
+	}
+}
+
+// Collapse the edge
+void Mesh::collapseEdge (int edge) {
+	if (recordInverses) {
+		collapseInverses.push_back(CollapseInverse());
+		saveCollapseInverse(this, edge, collapseInverses.back());
+	}
+
+	vec3 newVertexPosition(computeNewVertexPositionForEdgeCollapse(edge));
+
+	int start = edgeStart[edge];
+	int end = edgeEnd[edge];
+	int left = edgeLeft[edge];
+	int right = edgeRight[edge];
+
+	if (recordCollapses) {
+		CollapseRecord record = {start, end, getOtherVertex(edgeLeftNext[edge], end), getOtherVertex(edgeRightNext[edge], end), positions[start], positions[end]};
+		collapseRecords.push_back(record);
+	}
+
+	int leftNext = edgeLeftNext[edge];
+	int rightNext = edgeRightNext[edge];
+
+	relinkEdgeCollapse(edge, newVertexPosition, true);
+
+	// Delete from the highest index down, so that swap-remove never moves one of the deleted elements
+	int edges[3] = {edge, leftNext, rightNext};
+	std::sort(edges, edges + 3, std::greater<int>());
+
+	for (int i = 0; i < 3; i++) {
+		deleteEdge(edges[i]);
+	}
+
+	deleteFace(std::max(left, right));
+	deleteFace(std::min(left, right));
+	deleteVertex(end);
+}
+
+// Undo the edge collapse that the inverse was saved for, which must be the last one not undone
+// The swap-removes of the collapse are reversed first, moving the elements that took the freed
+// slots back to the end, so that the saved indices are valid again. Then the saved edges, faces
+// and vertices are restored and the edges around the removed vertex are given back to it. The
+// mesh, its edge map aside, is then exactly as before the collapse.
+void Mesh::undoCollapse (const CollapseInverse &inverse) {
+	int start = inverse.vertices[0];
+	int end = inverse.vertices[1];
+
+	resize(numVertices + 1, numEdges, numFaces);
+	if (end != numVertices)
+		moveVertex(end, numVertices);
+
+	int faces[2] = {std::min(inverse.faces[0], inverse.faces[1]), std::max(inverse.faces[0], inverse.faces[1])};
+	for (int i = 0; i < 2; i++) {
+		resize(numVertices, numEdges, numFaces + 1);
+		if (faces[i] != numFaces)
+			moveFace(faces[i], numFaces);
+	}
+
+	int edges[3] = {inverse.edges[0], inverse.edges[1], inverse.edges[2]};
+	std::sort(edges, edges + 3);
+	for (int i = 0; i < 3; i++) {
+		resize(numVertices, numEdges + 1, numFaces);
+		if (edges[i] != numEdges)
+			moveEdge(edges[i], numEdges);
+	}
+
+	for (int i = 0; i < 9; i++) {
+		int e = inverse.edges[i];
+		const int *links = inverse.edgeLinks[i];
+
+		edgeStart[e] = links[0];
+		edgeEnd[e] = links[1];
+		edgeLeft[e] = links[2];
+		edgeRight[e] = links[3];
+		edgeLeftPrev[e] = links[4];
+		edgeLeftNext[e] = links[5];
+		edgeRightPrev[e] = links[6];
+		edgeRightNext[e] = links[7];
+	}
+
+	for (int i = 0; i < 4; i++) {
+		faceEdge[inverse.faces[i]] = inverse.faceEdges[i];
+		vertexEdge[inverse.vertices[i]] = inverse.vertexEdges[i];
 	}
 
-	deleteVertex(edge->end);
-	deleteFace(edge->left);
-	deleteFace(edge->right);
-	deleteEdge(edge);
-	deleteEdge(leftNext);
-	deleteEdge(rightNext);
+	faceNormals[inverse.faces[0]] = inverse.faceNormals[0];
+	faceNormals[inverse.faces[1]] = inverse.faceNormals[1];
+
+	positions[start] = inverse.positions[0];
+	positions[end] = inverse.positions[1];
+	normals[end] = inverse.removedNormal;
+	if (hasQuadrics) {
+		quadrics[start] = inverse.quadrics[0];
+		quadrics[end] = inverse.quadrics[1];
+	}
+
+	// Walk the edges between the two deleted faces as collapseEdge did, giving back to the removed
+	// vertex those that were moved to the remaining one (some are already restored above)
+	int leftNext = inverse.edges[1];
+	int rightNext = inverse.edges[2];
+	int e = leftNext;
+	int numMoved = 0;
+
+	while (true) {
+		if (edgeStart[e] == end || edgeStart[e] == start) {
+			e = edgeRightPrev[e];
+		} else {
+			e = edgeLeftNext[e];
+		}
+
+		if (e == rightNext)
+			break;
+
+		numMoved++;
+
+		int other = (edgeStart[e] == start || edgeStart[e] == end) ? edgeEnd[e] : edgeStart[e];
+
+		uint64_t key = getEdgeKey(start, other);
+		int *index = edgeMap.find(key);
+		if (index != NULL && *index == e)
+			edgeMap.erase(key);
+
+		if (edgeStart[e] == start)
+			edgeStart[e] = end;
+		else if (edgeEnd[e] == start)
+			edgeEnd[e] = end;
+
+		edgeMap.insert(getEdgeKey(end, other), e);
+	}
+
+	for (int i = 0; i < 3; i++) {
+		edgeMap.insert(getEdgeKey(edgeStart[inverse.edges[i]], edgeEnd[inverse.edges[i]]), inverse.edges[i]);
+	}
+
+	// The removed vertex has the moved edges, the edge and the two edges deleted with it
+	valences[start] -= numMoved - 1;
+	valences[end] = numMoved + 3;
+	valences[inverse.vertices[2]]++;
+	valences[inverse.vertices[3]]++;
+
+	if (recordCollapses && !collapseRecords.empty())
+		collapseRecords.pop_back();
 }
 
 // Decimate mesh by collapsing n edges
 // Select an edge collapse amongst k randomly chosen candidate edges which gives the least quadric error
+// The remaining vertex is placed as collapseType says. Stops early if no edge can be collapsed
 void Mesh::decimate (int k, int n) {
-	map<W_edge*, bool> flagged;
+	sampler.reset(numEdges);
 
 	for(int i = 0; i < n; i++) {
-		W_edge *edge = getCandidateEdgeToCollapse(k, flagged);
+		int edge = getCandidateEdgeToCollapse(k);
+
+		while (edge != 0 && !canCollapseEdge(edge)) {
+			sampler.flag(edge); // Flag edge if it cannot be collapsed
+			edge = getCandidateEdgeToCollapse(k);
+		}
+
+		if (edge == 0)
+			break;
+
+		collapseEdge(edge);
+
+		// Edge indices are reused by the collapse, so the flags no longer apply
+		sampler.resize(numEdges);
+	}
+}
+
+// Collapse candidate in the greedy decimation queue
+// The entry is current only while stamps[edge] still equals its stamp.
+struct EdgeCollapse {
+	float error;
+	int edge;
+	unsigned int stamp;
+
+	bool operator> (const EdgeCollapse &other) const {
+		if (error != other.error)
+			return error > other.error;
+		return edge > other.edge;
+	}
+};
+
+// Compute the collapse error of an edge and push it on the queue, invalidating older entries
+static void pushEdgeCollapse (Mesh *mesh, int edge, vector<unsigned int> &stamps, unsigned int &stamp,
+		std::priority_queue<EdgeCollapse, vector<EdgeCollapse>, std::greater<EdgeCollapse> > &queue) {
+	vec3 newPosition;
+	float error;
+	mesh->evaluateEdgeCollapses(1, &edge, &newPosition, &error);
+
+	stamps[edge] = ++stamp;
+
+	EdgeCollapse collapse = {error, edge, stamp};
+	queue.push(collapse);
+}
+
+// Decimate mesh greedily until it has at most targetFaces faces or no collapse is below maxError
+// All edges are kept in a priority queue by collapse error. After a collapse only the edges around
+// the remaining vertex, and with memoryless errors those of its neighbours, are scored again.
+// Entries for edges that were re-scored, moved or deleted are recognized by their stamp and
+// skipped. Edges whose collapse would fold over or break the manifold leave the queue (stamp 0)
+// until a collapse next to them puts them back.
+void Mesh::greedyDecimation (int targetFaces, float maxError) {
+	LodLevel level = {targetFaces, maxError};
+	decimateToLevels(vector<LodLevel>(1, level), std::function<void (int)>());
+}
+
+// Decimate mesh greedily through a chain of levels of detail, calling snapshot(i) as the mesh
+// reaches level i
+// Level i is reached when the mesh has at most levels[i].targetFaces faces or no collapse is below
+// levels[i].maxError, so the levels should grow coarser. A level that is reached with an earlier
+// one gets the same mesh. The whole chain costs one decimation to the last level.
+void Mesh::decimateToLevels (const vector<LodLevel> &levels, const std::function<void (int)> &snapshot) {
+	std::priority_queue<EdgeCollapse, vector<EdgeCollapse>, std::greater<EdgeCollapse> > queue;
+	vector<unsigned int> stamps(numEdges + 1, 0);
+	unsigned int stamp = 0;
+
+	for (int e = 1; e <= numEdges; e++) {
+		pushEdgeCollapse(this, e, stamps, stamp, queue);
+	}
+
+	vector<int> edges;
+	size_t level = 0;
+
+	while (level < levels.size()) {
+		if (numFaces <= levels[level].targetFaces || queue.empty()) {
+			if (snapshot)
+				snapshot(level);
+			level++;
+			continue;
+		}
+
+		EdgeCollapse collapse = queue.top();
+
+		int edge = collapse.edge;
+		if (edge > numEdges || stamps[edge] != collapse.stamp) {
+			queue.pop();
+			continue;
+		}
+
+		// The cheapest collapse stays queued for the next level
+		if (collapse.error > levels[level].maxError) {
+			if (snapshot)
+				snapshot(level);
+			level++;
+			continue;
+		}
+
+		queue.pop();
 
-		while (canCauseNonManifoldMesh(edge) || canCauseFoldOver(edge)) {
-			flagged[edge] = true; // Flag edge if it cannot be collapsed
-			edge = getCandidateEdgeToCollapse(k, flagged);
+		if (!canCollapseEdge(edge)) {
+			stamps[edge] = 0;
+			continue;
 		}
 
+		// Swap-remove moves the last vertex into the deleted slot, which may be the remaining vertex
+		int start = edgeStart[edge];
+		int vertex = (start == numVertices) ? edgeEnd[edge] : start;
+
+		// Swap-remove also moves the last edges into the slots of the deleted edges
+		int deleted[3] = {edge, edgeLeftNext[edge], edgeRightNext[edge]};
+		std::sort(deleted, deleted + 3, std::greater<int>());
+
 		collapseEdge(edge);
+
+		edges.clear();
+		for (int i = 0; i < 3; i++) {
+			if (deleted[i] <= numEdges)
+				edges.push_back(deleted[i]);
+		}
+
+		// The error changes for the edges of the remaining vertex, the validity may also change for
+		// the edges opposite to it. A memoryless error also changes for the edges of its neighbours,
+		// as their faces moved with it.
+		int e1 = vertexEdge[vertex];
+		int e = e1;
+		do {
+			edges.push_back(e);
+
+			if (usesLocalCosts()) {
+				int neighbour = (edgeStart[e] == vertex) ? edgeEnd[e] : edgeStart[e];
+				int f1 = vertexEdge[neighbour];
+				int f = f1;
+				do {
+					edges.push_back(f);
+					f = (edgeStart[f] == neighbour) ? edgeLeftPrev[f] : edgeRightNext[f];
+				} while (f != f1);
+			}
+
+			int opposite = (edgeStart[e] == vertex) ? edgeLeftNext[e] : edgeRightPrev[e];
+			if (stamps[opposite] == 0)
+				edges.push_back(opposite);
+
+			if (edgeStart[e] == vertex) {
+				e = edgeLeftPrev[e];
+			} else {
+				e = edgeRightNext[e];
+			}
+		} while (e != e1);
+
+		std::sort(edges.begin(), edges.end());
+		edges.erase(std::unique(edges.begin(), edges.end()), edges.end());
+
+		for (size_t i = 0; i < edges.size(); i++) {
+			pushEdgeCollapse(this, edges[i], stamps, stamp, queue);
+		}
+	}
+}
+
+// Check whether a vertex or any of its neighbours carries the given mark, optionally marking them
+static bool isNeighbourhoodMarked (Mesh *mesh, int vertex, vector<unsigned int> &marks, unsigned int mark, bool setMarks) {
+	int e1 = mesh->vertexEdge[vertex];
+	int e = e1;
+
+	if (marks[vertex] == mark)
+		return true;
+	if (setMarks)
+		marks[vertex] = mark;
+
+	do {
+		int other = mesh->getOtherVertex(e, vertex);
+		if (marks[other] == mark)
+			return true;
+		if (setMarks)
+			marks[other] = mark;
+
+		if (mesh->edgeStart[e] == vertex) {
+			e = mesh->edgeLeftPrev[e];
+		} else {
+			e = mesh->edgeRightNext[e];
+		}
+	} while (e != e1);
+
+	return false;
+}
+
+// Apply independent edge collapses one at a time with collapseEdge, following the vertices that
+// swap-remove moves
+static void applyCollapsesInOrder (Mesh *mesh, const vector<int> &edges) {
+	vector<int> pairs;
+	for (size_t i = 0; i < edges.size(); i++) {
+		pairs.push_back(mesh->edgeStart[edges[i]]);
+		pairs.push_back(mesh->edgeEnd[edges[i]]);
+	}
+
+	// Collapses by vertex pair, as swap-remove renumbers the edges
+	vector<int> pairOfVertex(mesh->numVertices + 1, -1);
+	for (size_t i = 0; i < pairs.size(); i++) {
+		pairOfVertex[pairs[i]] = i / 2;
+	}
+
+	for (size_t i = 0; i < pairs.size(); i += 2) {
+		int edge = mesh->getEdge(pairs[i], pairs[i + 1]);
+		int end = mesh->edgeEnd[edge];
+		int last = mesh->numVertices;
+
+		pairOfVertex[pairs[i]] = pairOfVertex[pairs[i + 1]] = -1;
+
+		mesh->collapseEdge(edge);
+
+		if (last != end && pairOfVertex[last] >= 0) {
+			int pair = pairOfVertex[last];
+			if (pairs[2 * pair] == last)
+				pairs[2 * pair] = end;
+			else
+				pairs[2 * pair + 1] = end;
+
+			pairOfVertex[end] = pair;
+			pairOfVertex[last] = -1;
+		}
 	}
-}
\ No newline at end of file
+}
+
+// Move the kept elements of values to their new indices, passing each through map to renumber what
+// it refers to
+// Element i is kept if the prefix count index[i] goes up there, and count elements are kept. The old
+// array is left in buffer, so that the next array of the same type reuses its storage.
+template <typename T, typename Map>
+static void compactElements (vector<T> &values, const vector<int> &index, int count, vector<T> &buffer, Map map) {
+	buffer.resize(count + 1);
+	buffer[0] = values[0];
+
+	#pragma omp parallel for
+	for (int i = 1; i < (int) index.size(); i++) {
+		if (index[i] != index[i - 1])
+			buffer[index[i]] = map(values[i]);
+	}
+
+	values.swap(buffer);
+}
+
+// Drop the vertices, edges and faces whose entry in vertexIndex, edgeIndex or faceIndex is 0 rather
+// than 1, keeping the others in order, and renumber every reference to them
+// The entries become the new indices of the kept elements. The edge map is left as it was.
+static void compactMesh (Mesh *mesh, vector<int> &vertexIndex, vector<int> &edgeIndex, vector<int> &faceIndex,
+		vector<int> &intBuffer, vector<vec3> &vec3Buffer, vector<Quadric> &quadricBuffer) {
+	parallelPrefixSum(&vertexIndex[0], vertexIndex.size());
+	parallelPrefixSum(&edgeIndex[0], edgeIndex.size());
+	parallelPrefixSum(&faceIndex[0], faceIndex.size());
+
+	int numVertices = vertexIndex.back();
+	int numEdges = edgeIndex.back();
+	int numFaces = faceIndex.back();
+
+	auto toVertex = [&vertexIndex] (int v) { return vertexIndex[v]; };
+	auto toEdge = [&edgeIndex] (int e) { return edgeIndex[e]; };
+	auto toFace = [&faceIndex] (int f) { return faceIndex[f]; };
+	auto keepInt = [] (int value) { return value; };
+	auto keepVec3 = [] (vec3 value) { return value; };
+	auto keepQuadric = [] (const Quadric &value) { return value; };
+
+	compactElements(mesh->positions, vertexIndex, numVertices, vec3Buffer, keepVec3);
+	compactElements(mesh->normals, vertexIndex, numVertices, vec3Buffer, keepVec3);
+	if (mesh->hasQuadrics)
+		compactElements(mesh->quadrics, vertexIndex, numVertices, quadricBuffer, keepQuadric);
+	compactElements(mesh->vertexEdge, vertexIndex, numVertices, intBuffer, toEdge);
+	compactElements(mesh->valences, vertexIndex, numVertices, intBuffer, keepInt);
+
+	compactElements(mesh->edgeStart, edgeIndex, numEdges, intBuffer, toVertex);
+	compactElements(mesh->edgeEnd, edgeIndex, numEdges, intBuffer, toVertex);
+	compactElements(mesh->edgeLeft, edgeIndex, numEdges, intBuffer, toFace);
+	compactElements(mesh->edgeRight, edgeIndex, numEdges, intBuffer, toFace);
+	compactElements(mesh->edgeLeftPrev, edgeIndex, numEdges, intBuffer, toEdge);
+	compactElements(mesh->edgeLeftNext, edgeIndex, numEdges, intBuffer, toEdge);
+	compactElements(mesh->edgeRightPrev, edgeIndex, numEdges, intBuffer, toEdge);
+	compactElements(mesh->edgeRightNext, edgeIndex, numEdges, intBuffer, toEdge);
+
+	compactElements(mesh->faceEdge, faceIndex, numFaces, intBuffer, toEdge);
+	compactElements(mesh->faceNormals, faceIndex, numFaces, vec3Buffer, keepVec3);
+
+	mesh->numVertices = numVertices;
+	mesh->numEdges = numEdges;
+	mesh->numFaces = numFaces;
+}
+
+// Decimate mesh in rounds of independent edge collapses until it has at most targetFaces faces
+// or no collapse is below maxError
+// Each round scores every edge in parallel, then picks collapses among the cheapest quarter of the
+// edges in order of error (ties by edge index), skipping any edge that cannot be collapsed or whose
+// endpoints' 1-rings overlap those of an edge already picked. The picked collapses cannot change
+// each other's error or validity and write disjoint parts of the mesh, so threads apply them at
+// once, leaving the deleted elements in place, and the arrays are compacted once per round. The
+// result does not depend on the number of threads. Recording the collapses or their inverses needs
+// the numbering of collapseEdge, so then the picked collapses are applied one at a time instead.
+void Mesh::parallelDecimation (int targetFaces, float maxError) {
+	vector<float> errors;
+	vector<vec3> newPositions;
+	vector<int> candidates;
+	vector<unsigned int> marks;
+	unsigned int mark = 0;
+
+	// Whether each edge is known to be a valid collapse this round, checked by threads with their own
+	// vertex marks
+	enum {UNCHECKED, VALID, INVALID};
+	vector<char> validity;
+	int numThreads = omp_get_max_threads();
+	vector<vector<unsigned int> > threadMarks(numThreads);
+	vector<unsigned int> threadMark(numThreads, 0);
+
+	bool inPlace = !recordCollapses && !recordInverses;
+	bool isCompacted = false;
+
+	// Collapses picked in a round, and the new indices of the elements they keep
+	vector<int> picked;
+	vector<int> vertexIndex, edgeIndex, faceIndex;
+	vector<int> intBuffer;
+	vector<vec3> vec3Buffer;
+	vector<Quadric> quadricBuffer;
+
+	// Pick independent collapses among the candidates in [begin, end) in order, marking the
+	// neighbourhoods of the picked edges, until needed are picked
+	// Edges known to be invalid are skipped, and unchecked ones are taken as valid unless check is set.
+	auto scanCandidates = [&] (size_t begin, size_t end, size_t needed, bool check) {
+		marks.resize(numVertices + 1, 0);
+		mark++;
+		picked.clear();
+
+		for (size_t i = begin; i < end && picked.size() < needed; i++) {
+			int e = candidates[i];
+
+			if (validity[e] == INVALID)
+				continue;
+
+			if (isNeighbourhoodMarked(this, edgeStart[e], marks, mark, false) || isNeighbourhoodMarked(this, edgeEnd[e], marks, mark, false))
+				continue;
+
+			if (check && validity[e] == UNCHECKED)
+				validity[e] = isCollapseValid(this, e, &newPositions[e], vertexMarks, vertexMark) ? VALID : INVALID;
+
+			if (validity[e] == INVALID)
+				continue;
+
+			isNeighbourhoodMarked(this, edgeStart[e], marks, mark, true);
+			isNeighbourhoodMarked(this, edgeEnd[e], marks, mark, true);
+
+			picked.push_back(e);
+		}
+	};
+
+	// Pick up to needed independent collapses among the candidates in [begin, end)
+	// A first scan picks as if every edge were valid and its picks are checked in parallel. The second
+	// scan then picks as if each edge were checked in turn, only checking the few edges that the
+	// invalid picks of the first one had hidden.
+	auto pickCollapses = [&] (size_t begin, size_t end, size_t needed) {
+		scanCandidates(begin, end, needed, false);
+
+		#pragma omp parallel num_threads(numThreads)
+		{
+			int t = omp_get_thread_num();
+			unsigned int currentMark = threadMark[t];
+
+			#pragma omp for schedule(dynamic, 64)
+			for (size_t i = 0; i < picked.size(); i++) {
+				int e = picked[i];
+				validity[e] = isCollapseValid(this, e, &newPositions[e], threadMarks[t], currentMark) ? VALID : INVALID;
+			}
+
+			threadMark[t] = currentMark;
+		}
+
+		scanCandidates(begin, end, needed, true);
+	};
+
+	while (numFaces > targetFaces) {
+		errors.resize(numEdges + 1);
+		newPositions.resize(numEdges + 1);
+		candidates.resize(numEdges);
+		validity.assign(numEdges + 1, UNCHECKED);
+
+		#pragma omp parallel for schedule(dynamic, 1024)
+		for (int e = 1; e <= numEdges; e++) {
+			evaluateEdgeCollapses(1, &e, &newPositions[e], &errors[e]);
+
+			candidates[e - 1] = errors[e] <= maxError ? e : 0;
+		}
+
+		candidates.erase(std::remove(candidates.begin(), candidates.end(), 0), candidates.end());
+		if (candidates.empty())
+			break;
+
+		auto isCheaper = [&errors] (int a, int b) {
+			return errors[a] < errors[b] || (errors[a] == errors[b] && a < b);
+		};
+
+		size_t numCandidates = (candidates.size() + 3) / 4;
+		__gnu_parallel::nth_element(candidates.begin(), candidates.begin() + numCandidates - 1, candidates.end(), isCheaper);
+		__gnu_parallel::sort(candidates.begin(), candidates.begin() + numCandidates, isCheaper);
+
+		size_t needed = (numFaces - targetFaces + 1) / 2;
+		pickCollapses(0, numCandidates, needed);
+
+		// Go on to the other candidates only if none of the cheapest edges can be collapsed
+		if (picked.empty() && numCandidates < candidates.size()) {
+			__gnu_parallel::sort(candidates.begin() + numCandidates, candidates.end(), isCheaper);
+			pickCollapses(numCandidates, candidates.size(), needed);
+		}
+
+		if (picked.empty())
+			break;
+
+		if (!inPlace) {
+			applyCollapsesInOrder(this, picked);
+			continue;
+		}
+
+		// Apply the collapses at once, leaving what they delete in place with a 0 index
+		vertexIndex.assign(numVertices + 1, 1);
+		edgeIndex.assign(numEdges + 1, 1);
+		faceIndex.assign(numFaces + 1, 1);
+		vertexIndex[0] = edgeIndex[0] = faceIndex[0] = 0;
+
+		#pragma omp parallel for schedule(dynamic, 256)
+		for (size_t i = 0; i < picked.size(); i++) {
+			int edge = picked[i];
+			int end = edgeEnd[edge];
+			int left = edgeLeft[edge];
+			int right = edgeRight[edge];
+			int leftNext = edgeLeftNext[edge];
+			int rightNext = edgeRightNext[edge];
+
+			relinkEdgeCollapse(edge, newPositions[edge], false);
+
+			edgeIndex[edge] = edgeIndex[leftNext] = edgeIndex[rightNext] = 0;
+			faceIndex[left] = faceIndex[right] = 0;
+			vertexIndex[end] = 0;
+		}
+
+		compactMesh(this, vertexIndex, edgeIndex, faceIndex, intBuffer, vec3Buffer, quadricBuffer);
+		isCompacted = true;
+	}
+
+	// The edge map still has the indices from before the first compaction
+	if (isCompacted) {
+		vector<uint64_t> keys(numEdges);
+		vector<int> edges(numEdges);
+
+		#pragma omp parallel for
+		for (int e = 1; e <= numEdges; e++) {
+			keys[e - 1] = getEdgeKey(edgeStart[e], edgeEnd[e]);
+			edges[e - 1] = e;
+		}
+
+		edgeMap.clear();
+		edgeMap.insertAll(numEdges, keys.data(), edges.data());
+	}
+}
+
+// Claim the slot of a grid cell in a table sized for every vertex, keeping the lowest vertex index
+// in the cell as its value (the values start at INT_MAX)
+// Returns the slot, safe to call from several threads at once.
+static uint64_t claimCell (EdgeHash<int> &cells, uint64_t key, int vertex) {
+	uint64_t slot = cells.getSlot(key);
+
+	while (true) {
+		uint64_t found = 0;
+		if (__atomic_compare_exchange_n(&cells.keys[slot], &found, key, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED) || found == key)
+			break;
+		slot = (slot + 1) & cells.mask;
+	}
+
+	int current = __atomic_load_n(&cells.values[slot], __ATOMIC_RELAXED);
+	while (vertex < current && !__atomic_compare_exchange_n(&cells.values[slot], &current, vertex, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+
+	return slot;
+}
+
+// Remove the faces that are not kept from a list of three vertex indices per face, keeping the order
+static void keepFaces (vector<int> &indices, const vector<char> &isKept) {
+	int numFaces = isKept.size();
+	vector<int> position(numFaces + 1, 0);
+
+	#pragma omp parallel for
+	for (int f = 0; f < numFaces; f++) {
+		position[f + 1] = isKept[f] ? 1 : 0;
+	}
+
+	parallelPrefixSum(&position[0], numFaces + 1);
+
+	vector<int> keptIndices(3 * position[numFaces]);
+
+	#pragma omp parallel for
+	for (int f = 0; f < numFaces; f++) {
+		if (isKept[f])
+			std::copy(&indices[3 * f], &indices[3 * f + 3], &keptIndices[3 * position[f]]);
+	}
+
+	indices.swap(keptIndices);
+}
+
+// Keep one copy of each triangle, in the orientation that occurs more often
+// If a triangle occurs n times in one orientation and m times in the other, only the first copy
+// in the first orientation is kept when n > m, and none when n == m: copies in opposite
+// orientations enclose nothing, and all of them would join the same three edges.
+static void dropDuplicateFaces (int numVertices, vector<int> &indices) {
+	int numFaces = indices.size() / 3;
+
+	// Rotate each face to start at its lowest vertex
+	vector<int> rotated(indices.begin(), indices.end());
+
+	#pragma omp parallel for
+	for (int f = 0; f < numFaces; f++) {
+		int *corners = &rotated[3 * f];
+		std::rotate(corners, std::min_element(corners, corners + 3), corners + 3);
+	}
+
+	vector<int> offsets, groups;
+	parallelGroupBy(numFaces, numVertices + 1, [&] (int f) { return rotated[3 * f]; }, offsets, groups);
+
+	vector<char> isKept(numFaces, 1);
+
+	#pragma omp parallel for schedule(dynamic, 1024)
+	for (int v = 1; v <= numVertices; v++) {
+		for (int i = offsets[v]; i < offsets[v + 1]; i++) {
+			const int *corners = &rotated[3 * groups[i]];
+			int rank = 0, numSame = 0, numOpposite = 0;
+
+			for (int j = offsets[v]; j < offsets[v + 1]; j++) {
+				const int *other = &rotated[3 * groups[j]];
+
+				if (other[1] == corners[1] && other[2] == corners[2]) {
+					numSame++;
+					if (j < i)
+						rank++;
+				} else if (other[1] == corners[2] && other[2] == corners[1]) {
+					numOpposite++;
+				}
+			}
+
+			isKept[groups[i]] = rank == 0 && numSame > numOpposite;
+		}
+	}
+
+	keepFaces(indices, isKept);
+}
+
+// Find the representative of a corner, halving the path on the way
+static int findCorner (vector<int> &parent, int corner) {
+	while (parent[corner] != corner) {
+		parent[corner] = parent[parent[corner]];
+		corner = parent[corner];
+	}
+
+	return corner;
+}
+
+// Join the classes of two corners, the lower representative is kept
+static void joinCorners (vector<int> &parent, int a, int b) {
+	a = findCorner(parent, a);
+	b = findCorner(parent, b);
+
+	if (a < b)
+		parent[b] = a;
+	else if (b < a)
+		parent[a] = b;
+}
+
+// Give each fan of faces around a vertex its own copy of the vertex
+// indices holds three vertices per face. The i-th face using the directed edge u->v is joined to
+// the i-th face using v->u, and the corners at a vertex that are joined through such edges form a
+// fan. The vertices are replaced by one copy per fan, numbered in the order of their first corner.
+static void splitFans (vector<int> &indices, vector<vec3> &vertexPositions) {
+	int numVertices = vertexPositions.size() - 1;
+	int numHalfEdges = indices.size();
+
+	// Half edge h runs from corner h to the next corner of its face
+	vector<int> nextCorner(numHalfEdges);
+
+	#pragma omp parallel for
+	for (int h = 0; h < numHalfEdges; h++) {
+		nextCorner[h] = h - h % 3 + (h + 1) % 3;
+	}
+
+	vector<int> offsets, groups;
+	parallelGroupBy(numHalfEdges, numVertices + 1, [&] (int h) { return std::min(indices[h], indices[nextCorner[h]]); }, offsets, groups);
+
+	// Match the half edges of each edge in the two directions by their rank, in face order
+	vector<int> twins(numHalfEdges, -1);
+
+	#pragma omp parallel for schedule(dynamic, 1024)
+	for (int v = 1; v <= numVertices; v++) {
+		for (int i = offsets[v]; i < offsets[v + 1]; i++) {
+			int h = groups[i];
+			int start = indices[h], end = indices[nextCorner[h]];
+			if (start > end)
+				continue;
+
+			int rank = 0;
+			for (int j = offsets[v]; j < i; j++) {
+				int g = groups[j];
+				if (indices[g] == start && indices[nextCorner[g]] == end)
+					rank++;
+			}
+
+			for (int j = offsets[v]; j < offsets[v + 1]; j++) {
+				int g = groups[j];
+				if (indices[g] == end && indices[nextCorner[g]] == start && rank-- == 0) {
+					twins[h] = g;
+					twins[g] = h;
+					break;
+				}
+			}
+		}
+	}
+
+	vector<int> parent(numHalfEdges);
+	for (int h = 0; h < numHalfEdges; h++) {
+		parent[h] = h;
+	}
+
+	for (int h = 0; h < numHalfEdges; h++) {
+		int twin = twins[h];
+		if (twin > h) {
+			joinCorners(parent, h, nextCorner[twin]);
+			joinCorners(parent, nextCorner[h], twin);
+		}
+	}
+
+	// Number the fans by their representative corner
+	vector<int> fanIndex(numHalfEdges + 1, 0);
+	for (int h = 0; h < numHalfEdges; h++) {
+		fanIndex[h + 1] = (findCorner(parent, h) == h) ? 1 : 0;
+	}
+
+	parallelPrefixSum(&fanIndex[0], numHalfEdges + 1);
+
+	vector<vec3> fanPositions(fanIndex[numHalfEdges] + 1);
+
+	#pragma omp parallel for
+	for (int h = 0; h < numHalfEdges; h++) {
+		int fan = fanIndex[parent[h] + 1];
+		fanPositions[fan] = vertexPositions[indices[h]];
+		indices[h] = fan;
+	}
+
+	vertexPositions.swap(fanPositions);
+}
+
+// Drop the faces that repeat a directed edge of an earlier face, and close the holes this leaves
+// with new faces
+// Each hole is split into simple loops, a loop of three edges becomes a triangle and a longer one
+// a fan around a new vertex at its centre. Afterwards every directed edge is used once and has a
+// twin, though a vertex may have more than one fan. Returns false if no face was dropped.
+static bool dropRepeatedEdges (vector<int> &indices, vector<vec3> &vertexPositions) {
+	int numVertices = vertexPositions.size() - 1;
+	int numHalfEdges = indices.size();
+
+	vector<int> nextCorner(numHalfEdges);
+
+	#pragma omp parallel for
+	for (int h = 0; h < numHalfEdges; h++) {
+		nextCorner[h] = h - h % 3 + (h + 1) % 3;
+	}
+
+	vector<int> offsets, groups;
+	parallelGroupBy(numHalfEdges, numVertices + 1, [&] (int h) { return indices[h]; }, offsets, groups);
+
+	vector<char> isKept(numHalfEdges / 3, 1);
+	int numDropped = 0;
+
+	#pragma omp parallel for schedule(dynamic, 1024) reduction(+:numDropped)
+	for (int v = 1; v <= numVertices; v++) {
+		for (int i = offsets[v]; i < offsets[v + 1]; i++) {
+			for (int j = offsets[v]; j < i; j++) {
+				if (indices[nextCorner[groups[j]]] == indices[nextCorner[groups[i]]]) {
+					__atomic_store_n(&isKept[groups[i] / 3], 0, __ATOMIC_RELAXED);
+					numDropped++;
+					break;
+				}
+			}
+		}
+	}
+
+	if (numDropped == 0)
+		return false;
+
+	// The hole edges run opposite to the kept half edges without a kept twin
+	// A face left without any neighbour is dropped as well, rather than closed by its own reverse.
+	vector<char> hasTwin(numHalfEdges, 0);
+
+	#pragma omp parallel for
+	for (int h = 0; h < numHalfEdges; h++) {
+		int start = indices[h], end = indices[nextCorner[h]];
+
+		for (int j = offsets[end]; j < offsets[end + 1] && !hasTwin[h]; j++) {
+			int g = groups[j];
+			hasTwin[h] = isKept[g / 3] && indices[nextCorner[g]] == start;
+		}
+	}
+
+	vector<uint64_t> holeEdges;
+
+	for (int f = 0; f < numHalfEdges / 3; f++) {
+		if (!isKept[f])
+			continue;
+
+		if (!hasTwin[3 * f] && !hasTwin[3 * f + 1] && !hasTwin[3 * f + 2]) {
+			isKept[f] = 0;
+			continue;
+		}
+
+		for (int h = 3 * f; h < 3 * f + 3; h++) {
+			if (!hasTwin[h])
+				holeEdges.push_back((uint64_t) indices[nextCorner[h]] << 32 | (uint32_t) indices[h]);
+		}
+	}
+
+	std::sort(holeEdges.begin(), holeEdges.end());
+
+	keepFaces(indices, isKept);
+
+	// Walk the hole edges, cutting off a loop whenever the walk comes back to a vertex on its path
+	vector<char> isUsed(holeEdges.size(), 0);
+	vector<int> pathIndex(numVertices + 1, -1);
+	vector<int> path;
+
+	for (size_t first = 0; first < holeEdges.size(); first++) {
+		if (isUsed[first])
+			continue;
+
+		int vertex = holeEdges[first] >> 32;
+		path.assign(1, vertex);
+		pathIndex[vertex] = 0;
+
+		while (!path.empty()) {
+			// Every vertex on a hole has as many hole edges in as out, so an unused one is left
+			size_t e = std::lower_bound(holeEdges.begin(), holeEdges.end(), (uint64_t) vertex << 32) - holeEdges.begin();
+			while (isUsed[e])
+				e++;
+
+			isUsed[e] = 1;
+			vertex = (uint32_t) holeEdges[e];
+
+			if (pathIndex[vertex] < 0) {
+				pathIndex[vertex] = path.size();
+				path.push_back(vertex);
+				continue;
+			}
+
+			int begin = pathIndex[vertex];
+			int size = path.size() - begin;
+
+			if (size == 3) {
+				indices.insert(indices.end(), path.begin() + begin, path.end());
+			} else {
+				vec3 centre(0.0);
+				for (int i = begin; i < (int) path.size(); i++)
+					centre = centre + vertexPositions[path[i]];
+
+				vertexPositions.push_back(centre / (float) size);
+				int centreVertex = vertexPositions.size() - 1;
+
+				for (int i = 0; i < size; i++) {
+					indices.push_back(path[begin + i]);
+					indices.push_back(path[begin + (i + 1) % size]);
+					indices.push_back(centreVertex);
+				}
+			}
+
+			for (int i = begin + 1; i < (int) path.size(); i++)
+				pathIndex[path[i]] = -1;
+			path.resize(begin + 1);
+
+			if (begin == 0) {
+				pathIndex[vertex] = -1;
+				path.clear();
+			}
+		}
+	}
+
+	return true;
+}
+
+// Build the mesh from clustered triangles, given as in buildFromIndexedTriangles
+// Degenerate triangles are dropped and repeated ones are kept once, if at all. Where thin
+// parts of a model met in a cluster the rest is not a manifold, so the vertex is split into one
+// vertex per fan of triangles and triangles that still repeat an edge are replaced. The result is
+// a closed manifold if the unclustered triangles were. Both arrays are consumed.
+void Mesh::buildFromClusteredTriangles (vector<vec3> &vertexPositions, vector<int> &indices) {
+	int nf = indices.size() / 3;
+	vector<char> isKept(nf);
+
+	#pragma omp parallel for
+	for (int f = 0; f < nf; f++) {
+		const int *corners = &indices[3 * f];
+		isKept[f] = corners[0] != corners[1] && corners[1] != corners[2] && corners[2] != corners[0];
+	}
+
+	keepFaces(indices, isKept);
+	dropDuplicateFaces(vertexPositions.size() - 1, indices);
+
+	splitFans(indices, vertexPositions);
+
+	if (dropRepeatedEdges(indices, vertexPositions))
+		splitFans(indices, vertexPositions);
+
+	buildFromIndexedTriangles(vertexPositions, indices);
+}
+
+// Decimate mesh by vertex clustering on a uniform grid of gridSize cells along the longest side
+// of the bounding box
+// The vertices of each occupied cell merge into one, placed where the sum of their quadrics is
+// least, and the mesh is rebuilt from the faces that keep three distinct corners. A mesh without
+// quadrics sums them from the faces. The work is linear in the size of the mesh and, except for
+// summing the quadrics, runs in parallel.
+void Mesh::clusterDecimation (int gridSize) {
+	if (numVertices == 0 || gridSize < 1)
+		return;
+
+	computeBoundingBox();
+	ClusterGrid grid(vec3(xMin, yMin, zMin), vec3(xMax, yMax, zMax), gridSize);
+
+	EdgeHash<int> cells;
+	cells.reserve(std::min((uint64_t) numVertices, (uint64_t) grid.size * grid.size * grid.size));
+	std::fill(cells.values.begin(), cells.values.end(), INT_MAX);
+
+	vector<uint64_t> vertexSlot(numVertices + 1);
+	vector<uint64_t> vertexCell(numVertices + 1);
+
+	#pragma omp parallel for
+	for (int v = 1; v <= numVertices; v++) {
+		vertexCell[v] = grid.getCell(positions[v]);
+		vertexSlot[v] = claimCell(cells, vertexCell[v], v);
+	}
+
+	// Clusters are numbered in the order of their lowest vertex
+	vector<int> clusterIndex(numVertices + 1, 0);
+
+	#pragma omp parallel for
+	for (int v = 1; v <= numVertices; v++) {
+		clusterIndex[v] = (cells.values[vertexSlot[v]] == v) ? 1 : 0;
+	}
+
+	parallelPrefixSum(&clusterIndex[0], numVertices + 1);
+	int numClusters = clusterIndex[numVertices];
+
+	vector<int> clusterOf(numVertices + 1, 0);
+
+	#pragma omp parallel for
+	for (int v = 1; v <= numVertices; v++) {
+		clusterOf[v] = clusterIndex[cells.values[vertexSlot[v]]];
+	}
+
+	// Place each cluster at the minimum of its summed quadric
+	vector<Quadric> clusterQuadrics(numClusters + 1);
+	vector<vec3> clusterPositions(numClusters + 1, vec3(0.0));
+	vector<int> clusterSizes(numClusters + 1, 0);
+	vector<uint64_t> clusterCell(numClusters + 1);
+
+	for (int v = 1; v <= numVertices; v++) {
+		int c = clusterOf[v];
+		clusterQuadrics[c] += hasQuadrics ? quadrics[v] : getVertexQuadric(v);
+		clusterPositions[c] = clusterPositions[c] + positions[v];
+		clusterSizes[c]++;
+		clusterCell[c] = vertexCell[v];
+	}
+
+	#pragma omp parallel for
+	for (int c = 1; c <= numClusters; c++) {
+		clusterPositions[c] = grid.getClusterPosition(clusterCell[c], clusterQuadrics[c], clusterPositions[c] / (float) clusterSizes[c]);
+	}
+
+	// Map the faces onto the clusters
+	vector<int> indices(3 * numFaces);
+
+	#pragma omp parallel for
+	for (int f = 1; f <= numFaces; f++) {
+		int vertices[3];
+		getAllVerticesForFace(f, vertices);
+
+		for (int j = 0; j < 3; j++)
+			indices[3 * (f - 1) + j] = clusterOf[vertices[j]];
+	}
+
+	buildFromClusteredTriangles(clusterPositions, indices);
+}
@@ -0,0 +1,260 @@
+#include <mesh_cache.h>
+#include <fstream>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+using std::ofstream;
+
+// Name of the cache kept next to an SMF file
+string getMeshCacheFilename (string smfFilename) {
+	return smfFilename + ".cache";
+}
+
+// Fetch the size and modification time (in nanoseconds) of a file, false if it cannot be read
+static bool getFileStamp (string filename, uint64_t &size, int64_t &modified) {
+	struct stat fileStat;
+
+	if (stat(filename.c_str(), &fileStat) != 0)
+		return false;
+
+	size = fileStat.st_size;
+	modified = (int64_t) fileStat.st_mtim.tv_sec * 1000000000 + fileStat.st_mtim.tv_nsec;
+	return true;
+}
+
+// Round an offset up to the section alignment
+static inline uint64_t alignOffset (uint64_t offset) {
+	return (offset + MESH_CACHE_ALIGNMENT - 1) / MESH_CACHE_ALIGNMENT * MESH_CACHE_ALIGNMENT;
+}
+
+// Size in bytes of each section for the counts and flags in a header
+static void getSectionSizes (const MeshCacheHeader &header, uint64_t sizes[NUM_SECTIONS]) {
+	uint64_t numVertices = (uint64_t) header.numVertices + 1;
+	uint64_t numEdges = (uint64_t) header.numEdges + 1;
+	uint64_t numFaces = (uint64_t) header.numFaces + 1;
+
+	sizes[SECTION_POSITIONS] = numVertices * sizeof(vec3);
+	sizes[SECTION_NORMALS] = (header.flags & CACHE_NORMALS) ? numVertices * sizeof(vec3) : 0;
+	sizes[SECTION_QUADRICS] = (header.flags & CACHE_QUADRICS) ? numVertices * sizeof(Quadric) : 0;
+	sizes[SECTION_VERTEX_EDGE] = numVertices * sizeof(int);
+
+	for (int i = SECTION_EDGE_START; i <= SECTION_EDGE_RIGHT_NEXT; i++)
+		sizes[i] = numEdges * sizeof(int);
+
+	sizes[SECTION_FACE_EDGE] = numFaces * sizeof(int);
+	sizes[SECTION_FACE_NORMALS] = numFaces * sizeof(vec3);
+	sizes[SECTION_EDGE_MAP_KEYS] = header.edgeMapCapacity * sizeof(uint64_t);
+	sizes[SECTION_EDGE_MAP_VALUES] = header.edgeMapCapacity * sizeof(int);
+}
+
+// Write the mesh arrays to a cache file
+// If sourceFilename is given, the cache is stamped with it and reading it back checks that it is
+// still up to date. The file is written under a temporary name and renamed into place, so a
+// reader never sees a partial cache. Returns false if the cache could not be written.
+bool writeMeshCache (Mesh *mesh, string filename, string sourceFilename, int flags) {
+	MeshCacheHeader header;
+	memset(&header, 0, sizeof(header));
+
+	header.magic = MESH_CACHE_MAGIC;
+	header.version = MESH_CACHE_VERSION;
+	header.flags = mesh->hasQuadrics ? flags : flags & ~CACHE_QUADRICS;
+	header.numVertices = mesh->numVertices;
+	header.numEdges = mesh->numEdges;
+	header.numFaces = mesh->numFaces;
+	header.edgeMapCount = mesh->edgeMap.count;
+	header.edgeMapCapacity = mesh->edgeMap.keys.size();
+
+	if (sourceFilename.size() != 0 && !getFileStamp(sourceFilename, header.sourceSize, header.sourceModified))
+		return false;
+
+	const void *sections[NUM_SECTIONS] = {
+		&mesh->positions[0], &mesh->normals[0], mesh->quadrics.data(), &mesh->vertexEdge[0],
+		&mesh->edgeStart[0], &mesh->edgeEnd[0], &mesh->edgeLeft[0], &mesh->edgeRight[0],
+		&mesh->edgeLeftPrev[0], &mesh->edgeLeftNext[0], &mesh->edgeRightPrev[0], &mesh->edgeRightNext[0],
+		&mesh->faceEdge[0], &mesh->faceNormals[0], mesh->edgeMap.keys.data(), mesh->edgeMap.values.data()
+	};
+
+	uint64_t sizes[NUM_SECTIONS];
+	getSectionSizes(header, sizes);
+
+	uint64_t offset = alignOffset(sizeof(header));
+	for (int i = 0; i < NUM_SECTIONS; i++) {
+		header.sectionOffsets[i] = offset;
+		header.sectionSizes[i] = sizes[i];
+		offset = alignOffset(offset + sizes[i]);
+	}
+
+	string temporaryFilename = filename + ".tmp";
+	ofstream cache_file;
+	cache_file.open(temporaryFilename.c_str(), std::ios::binary);
+
+	if (cache_file.fail())
+		return false;
+
+	char padding[MESH_CACHE_ALIGNMENT] = {0};
+	uint64_t position = sizeof(header);
+	cache_file.write((const char *) &header, sizeof(header));
+
+	for (int i = 0; i < NUM_SECTIONS; i++) {
+		cache_file.write(padding, header.sectionOffsets[i] - position);
+		cache_file.write((const char *) sections[i], sizes[i]);
+		position = header.sectionOffsets[i] + sizes[i];
+	}
+
+	cache_file.close();
+
+	if (cache_file.fail() || rename(temporaryFilename.c_str(), filename.c_str()) != 0) {
+		remove(temporaryFilename.c_str());
+		return false;
+	}
+
+	return true;
+}
+
+// Copy a section of the mapped cache into a mesh array
+template <typename T>
+static void readSection (const char *data, const MeshCacheHeader &header, int section, vector<T> &values) {
+	if (header.sectionSizes[section] != 0)
+		memcpy(values.data(), data + header.sectionOffsets[section], header.sectionSizes[section]);
+}
+
+// Check that every value of an index array lies in [first, last]
+static bool isInRange (const vector<int> &values, int begin, int end, int first, int last) {
+	bool valid = true;
+
+	#pragma omp parallel for reduction(&&: valid)
+	for (int i = begin; i < end; i++) {
+		valid = valid && values[i] >= first && values[i] <= last;
+	}
+
+	return valid;
+}
+
+// Check that the links of a mesh read from a cache address its vertices, edges and faces
+// A damaged or stale cache can hold any values, and the ring walks would follow them out of the arrays.
+static bool hasValidLinks (Mesh *mesh) {
+	int nv = mesh->numVertices, ne = mesh->numEdges, nf = mesh->numFaces;
+	const EdgeHash<int> &edgeMap = mesh->edgeMap;
+
+	// The edge map needs an empty slot to end each probe
+	size_t numKeys = edgeMap.keys.size() - std::count(edgeMap.keys.begin(), edgeMap.keys.end(), (uint64_t) 0);
+	if (numKeys != (size_t) edgeMap.count || numKeys != (size_t) ne || (ne > 0 && numKeys >= edgeMap.keys.size()))
+		return false;
+
+	return isInRange(mesh->vertexEdge, 1, nv + 1, 0, ne)
+		&& isInRange(mesh->edgeStart, 1, ne + 1, 1, nv) && isInRange(mesh->edgeEnd, 1, ne + 1, 1, nv)
+		&& isInRange(mesh->edgeLeft, 1, ne + 1, 0, nf) && isInRange(mesh->edgeRight, 1, ne + 1, 0, nf)
+		&& isInRange(mesh->edgeLeftPrev, 1, ne + 1, 0, ne) && isInRange(mesh->edgeLeftNext, 1, ne + 1, 0, ne)
+		&& isInRange(mesh->edgeRightPrev, 1, ne + 1, 0, ne) && isInRange(mesh->edgeRightNext, 1, ne + 1, 0, ne)
+		&& isInRange(mesh->faceEdge, 1, nf + 1, 1, ne)
+		&& isInRange(edgeMap.values, 0, edgeMap.values.size(), 0, ne);
+}
+
+// Read a mesh from a cache file, with or without the quadric of each vertex
+// Returns NULL if the file is missing, is not a cache of this version, is truncated, holds links
+// outside the mesh, or (if sourceFilename is given) was written for a different version of the
+// source file.
+Mesh *readMeshCache (string filename, string sourceFilename, bool hasQuadrics) {
+	int fd = open(filename.c_str(), O_RDONLY);
+	struct stat fileStat;
+
+	if (fd < 0)
+		return NULL;
+
+	if (fstat(fd, &fileStat) != 0 || (size_t) fileStat.st_size < sizeof(MeshCacheHeader)) {
+		close(fd);
+		return NULL;
+	}
+
+	size_t size = fileStat.st_size;
+	const char *data = (const char *) mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	if (data == MAP_FAILED)
+		return NULL;
+
+	MeshCacheHeader header;
+	memcpy(&header, data, sizeof(header));
+
+	uint64_t sizes[NUM_SECTIONS];
+	getSectionSizes(header, sizes);
+
+	bool valid = header.magic == MESH_CACHE_MAGIC && header.version == MESH_CACHE_VERSION
+		&& header.numVertices >= 0 && header.numEdges >= 0 && header.numFaces >= 0
+		&& (header.edgeMapCapacity & (header.edgeMapCapacity - 1)) == 0;
+
+	for (int i = 0; valid && i < NUM_SECTIONS; i++) {
+		valid = header.sectionSizes[i] == sizes[i] && header.sectionOffsets[i] % MESH_CACHE_ALIGNMENT == 0
+			&& header.sectionOffsets[i] <= size && sizes[i] <= size - header.sectionOffsets[i];
+	}
+
+	if (valid && sourceFilename.size() != 0) {
+		uint64_t sourceSize;
+		int64_t sourceModified;
+		valid = getFileStamp(sourceFilename, sourceSize, sourceModified)
+			&& sourceSize == header.sourceSize && sourceModified == header.sourceModified;
+	}
+
+	if (!valid) {
+		munmap((void *) data, size);
+		return NULL;
+	}
+
+	Mesh *mesh = new Mesh();
+	mesh->hasQuadrics = hasQuadrics;
+	mesh->resize(header.numVertices, header.numEdges, header.numFaces);
+
+	readSection(data, header, SECTION_POSITIONS, mesh->positions);
+	readSection(data, header, SECTION_NORMALS, mesh->normals);
+	if (hasQuadrics)
+		readSection(data, header, SECTION_QUADRICS, mesh->quadrics);
+	readSection(data, header, SECTION_VERTEX_EDGE, mesh->vertexEdge);
+
+	readSection(data, header, SECTION_EDGE_START, mesh->edgeStart);
+	readSection(data, header, SECTION_EDGE_END, mesh->edgeEnd);
+	readSection(data, header, SECTION_EDGE_LEFT, mesh->edgeLeft);
+	readSection(data, header, SECTION_EDGE_RIGHT, mesh->edgeRight);
+	readSection(data, header, SECTION_EDGE_LEFT_PREV, mesh->edgeLeftPrev);
+	readSection(data, header, SECTION_EDGE_LEFT_NEXT, mesh->edgeLeftNext);
+	readSection(data, header, SECTION_EDGE_RIGHT_PREV, mesh->edgeRightPrev);
+	readSection(data, header, SECTION_EDGE_RIGHT_NEXT, mesh->edgeRightNext);
+
+	readSection(data, header, SECTION_FACE_EDGE, mesh->faceEdge);
+	readSection(data, header, SECTION_FACE_NORMALS, mesh->faceNormals);
+
+	mesh->edgeMap.keys.resize(header.edgeMapCapacity);
+	mesh->edgeMap.values.resize(header.edgeMapCapacity);
+	mesh->edgeMap.mask = header.edgeMapCapacity - 1;
+	mesh->edgeMap.count = header.edgeMapCount;
+	readSection(data, header, SECTION_EDGE_MAP_KEYS, mesh->edgeMap.keys);
+	readSection(data, header, SECTION_EDGE_MAP_VALUES, mesh->edgeMap.values);
+
+	munmap((void *) data, size);
+
+	if (!hasValidLinks(mesh)) {
+		delete mesh;
+		return NULL;
+	}
+
+	mesh->computeValences();
+
+	// Rebuild the attributes that were left out of the cache
+	if (!(header.flags & CACHE_NORMALS) || (hasQuadrics && !(header.flags & CACHE_QUADRICS))) {
+		for (int f = 1; f <= mesh->numFaces; f++) {
+			int vertices[3];
+			mesh->getAllVerticesForFace(f, vertices);
+
+			if (!(header.flags & CACHE_NORMALS))
+				mesh->updateVertexNormalForEachVertex(f, vertices[0], vertices[1], vertices[2]);
+
+			if (!(header.flags & CACHE_QUADRICS))
+				mesh->updateQuadricForEachVertex(f, vertices[0], vertices[1], vertices[2]);
+		}
+	}
+
+	return mesh;
+}
@@ -0,0 +1,162 @@
+#include <mesh_history.h>
+
+// Estimate the memory held by a mesh
+static size_t getMeshBytes (Mesh *mesh) {
+	size_t vertexBytes = 2 * sizeof(vec3) + 2 * sizeof(int);
+	size_t edgeBytes = 8 * sizeof(int);
+	size_t faceBytes = sizeof(int) + sizeof(vec3);
+	size_t edgeMapBytes = mesh->edgeMap.keys.size() * (sizeof(uint64_t) + sizeof(int));
+
+	size_t quadricBytes = mesh->quadrics.size() * sizeof(Quadric);
+
+	return mesh->numVertices * vertexBytes + quadricBytes + mesh->numEdges * edgeBytes + mesh->numFaces * faceBytes + edgeMapBytes;
+}
+
+// Drop all entries
+void MeshHistory::clear () {
+	for (size_t i = 0; i < undoEntries.size(); i++)
+		delete undoEntries[i].mesh;
+
+	for (size_t i = 0; i < redoEntries.size(); i++)
+		delete redoEntries[i].mesh;
+
+	undoEntries.clear();
+	redoEntries.clear();
+	numBytes = 0;
+}
+
+// Push an entry for a new edit, which drops the edits that could be redone
+void MeshHistory::push (MeshHistoryEntry &entry) {
+	for (size_t i = 0; i < redoEntries.size(); i++) {
+		numBytes -= redoEntries[i].numBytes;
+		delete redoEntries[i].mesh;
+	}
+	redoEntries.clear();
+
+	undoEntries.push_back(MeshHistoryEntry());
+	undoEntries.back().inverses.swap(entry.inverses);
+	undoEntries.back().collapseType = entry.collapseType;
+	undoEntries.back().mesh = entry.mesh;
+	undoEntries.back().numBytes = entry.numBytes;
+	numBytes += entry.numBytes;
+
+	trim();
+}
+
+// Start recording the collapses of a decimation of the mesh
+void MeshHistory::beginDecimation (Mesh *mesh) {
+	mesh->collapseInverses.clear();
+	mesh->recordInverses = true;
+}
+
+// Stop recording and push the decimation, if it collapsed any edge
+void MeshHistory::endDecimation (Mesh *mesh) {
+	mesh->recordInverses = false;
+
+	if (mesh->collapseInverses.empty())
+		return;
+
+	MeshHistoryEntry entry;
+	entry.inverses.swap(mesh->collapseInverses);
+	entry.collapseType = mesh->collapseType;
+	entry.mesh = NULL;
+	entry.numBytes = entry.inverses.size() * sizeof(CollapseInverse);
+	push(entry);
+}
+
+// Push an edit that replaced or rebuilt the mesh, keeping the mesh from before it
+// A kept mesh records no inverses, even if it was copied during a decimation: they would pile up
+// uncounted when it comes back and a decimation is redone on it.
+void MeshHistory::pushMesh (Mesh *previousMesh) {
+	previousMesh->recordInverses = false;
+	previousMesh->collapseInverses.clear();
+
+	MeshHistoryEntry entry;
+	entry.collapseType = previousMesh->collapseType;
+	entry.mesh = previousMesh;
+	entry.numBytes = getMeshBytes(previousMesh);
+	push(entry);
+}
+
+// Undo the last edit, returning false if there is none
+bool MeshHistory::undo (Mesh *&mesh) {
+	if (undoEntries.empty())
+		return false;
+
+	redoEntries.push_back(MeshHistoryEntry());
+	MeshHistoryEntry &entry = redoEntries.back();
+	entry.inverses.swap(undoEntries.back().inverses);
+	entry.collapseType = undoEntries.back().collapseType;
+	entry.mesh = undoEntries.back().mesh;
+	entry.numBytes = undoEntries.back().numBytes;
+	undoEntries.pop_back();
+
+	if (entry.mesh == NULL) {
+		for (int i = entry.inverses.size() - 1; i >= 0; i--)
+			mesh->undoCollapse(entry.inverses[i]);
+		return true;
+	}
+
+	std::swap(entry.mesh, mesh);
+
+	numBytes -= entry.numBytes;
+	entry.numBytes = getMeshBytes(entry.mesh);
+	numBytes += entry.numBytes;
+
+	trim();
+	return true;
+}
+
+// Redo the last undone edit, returning false if there is none
+bool MeshHistory::redo (Mesh *&mesh) {
+	if (redoEntries.empty())
+		return false;
+
+	undoEntries.push_back(MeshHistoryEntry());
+	MeshHistoryEntry &entry = undoEntries.back();
+	entry.inverses.swap(redoEntries.back().inverses);
+	entry.collapseType = redoEntries.back().collapseType;
+	entry.mesh = redoEntries.back().mesh;
+	entry.numBytes = redoEntries.back().numBytes;
+	redoEntries.pop_back();
+
+	// The same edges collapse to the same mesh if the vertices are placed as before
+	// The entry already holds their inverses, so the mesh must not record them again.
+	if (entry.mesh == NULL) {
+		int collapseType = mesh->collapseType;
+		bool recordInverses = mesh->recordInverses;
+		mesh->collapseType = entry.collapseType;
+		mesh->recordInverses = false;
+
+		for (size_t i = 0; i < entry.inverses.size(); i++)
+			mesh->collapseEdge(entry.inverses[i].edge);
+
+		mesh->collapseType = collapseType;
+		mesh->recordInverses = recordInverses;
+		return true;
+	}
+
+	std::swap(entry.mesh, mesh);
+
+	numBytes -= entry.numBytes;
+	entry.numBytes = getMeshBytes(entry.mesh);
+	numBytes += entry.numBytes;
+
+	trim();
+	return true;
+}
+
+// Drop entries until the history fits in maxBytes
+void MeshHistory::trim () {
+	while (numBytes > maxBytes && !undoEntries.empty()) {
+		numBytes -= undoEntries.front().numBytes;
+		delete undoEntries.front().mesh;
+		undoEntries.pop_front();
+	}
+
+	while (numBytes > maxBytes && !redoEntries.empty()) {
+		numBytes -= redoEntries.front().numBytes;
+		delete redoEntries.front().mesh;
+		redoEntries.erase(redoEntries.begin());
+	}
+}
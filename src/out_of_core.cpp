@@ -0,0 +1,330 @@
+#include <out_of_core.h>
+#include <smf_parser.h>
+#include <cluster_grid.h>
+#include <cmath>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+
+// Bytes kept for each input vertex: its position and its cluster
+#define BYTES_PER_VERTEX (sizeof(vec3) + sizeof(int))
+
+// Bytes kept for each cluster while the faces are streamed: its quadric, cell and vertex count,
+// the position sum that becomes its position and up to four hash table slots
+#define BYTES_PER_CLUSTER (sizeof(Quadric) + sizeof(uint64_t) + sizeof(int) + sizeof(vec3) + 4 * (sizeof(uint64_t) + sizeof(int)))
+
+// Faces kept per cluster at most, a closed mesh has about two
+#define FACES_PER_CLUSTER 3
+
+// Bytes kept for each face: its clusters, its winding and up to four hash table slots
+#define BYTES_PER_FACE (4 * sizeof(int) + 4 * (sizeof(uint64_t) + sizeof(int)))
+
+// Estimated bytes for each vertex of the decimated mesh while it is built
+#define BYTES_PER_OUTPUT_VERTEX 512
+
+// Read an SMF file in blocks, calling process(positions, indices) with the records of each block
+// until it returns false
+// Every block ends at a line boundary, the rest of the last line is carried over to the next one.
+// Returns false if the file cannot be read, but not if process stopped the reading.
+template <typename Process>
+static bool streamSmfFile (string filename, Process process) {
+	int fd = open(filename.c_str(), O_RDONLY);
+	if (fd < 0)
+		return false;
+
+	vector<char> buffer(SMF_STREAM_BLOCK_SIZE);
+	vector<vec3> positions;
+	vector<int> indices;
+	size_t filled = 0;
+
+	while (true) {
+		ssize_t count = read(fd, &buffer[filled], buffer.size() - filled);
+		if (count < 0) {
+			close(fd);
+			return false;
+		}
+
+		filled += count;
+		size_t length = filled;
+
+		if (count > 0) {
+			const char *newline = (const char *) memrchr(&buffer[0], '\n', filled);
+
+			// A line longer than the buffer needs a larger one
+			if (newline == NULL) {
+				if (filled == buffer.size())
+					buffer.resize(2 * buffer.size());
+				continue;
+			}
+
+			length = newline + 1 - &buffer[0];
+		}
+
+		positions.clear();
+		indices.clear();
+		parseSmfRecordsParallel(&buffer[0], &buffer[length], positions, indices);
+		if (!process(positions, indices))
+			break;
+
+		memmove(&buffer[0], &buffer[length], filled - length);
+		filled -= length;
+
+		if (count == 0)
+			break;
+	}
+
+	close(fd);
+	return true;
+}
+
+// Put the vertices into the cells of a grid with gridSize cells along the longest side of the box
+// Clusters are numbered from 1 in the order of their first vertex. Returns false, leaving the
+// clusters incomplete, as soon as more than maxClusters cells are occupied.
+static bool assignClusters (const vector<vec3> &positions, const ClusterGrid &grid, size_t maxClusters, vector<int> &clusterOf, vector<uint64_t> &clusterCell) {
+	EdgeHash<int> cells;
+	cells.reserve(std::min(positions.size(), maxClusters));
+
+	clusterOf.assign(positions.size(), 0);
+	clusterCell.assign(1, 0);
+
+	for (size_t v = 1; v < positions.size(); v++) {
+		uint64_t cell = grid.getCell(positions[v]);
+		int *cluster = cells.find(cell);
+
+		if (cluster != NULL) {
+			clusterOf[v] = *cluster;
+		} else if (clusterCell.size() <= maxClusters) {
+			clusterOf[v] = clusterCell.size();
+			cells.insert(cell, clusterOf[v]);
+			clusterCell.push_back(cell);
+		} else {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+// Key of the triangle between three distinct clusters, the same for both orientations
+// Never zero, so that keys can go straight into an EdgeHash.
+static inline uint64_t getTriangleKey (const int corners[3]) {
+	int low = std::min(corners[0], std::min(corners[1], corners[2]));
+	int high = std::max(corners[0], std::max(corners[1], corners[2]));
+	int middle = corners[0] + corners[1] + corners[2] - low - high;
+
+	uint64_t key = (uint64_t) low * 0x9E3779B97F4A7C15ULL ^ (uint64_t) middle * 0xC2B2AE3D27D4EB4FULL ^ (uint64_t) high * 0x165667B19E3779F9ULL;
+	return key ? key : 1;
+}
+
+// Check whether two faces hold the same triangle, returning 1 if they have the same orientation,
+// -1 if they have opposite ones and 0 if they are different triangles
+static inline int compareTriangles (const int *a, const int *b) {
+	for (int j = 0; j < 3; j++) {
+		if (a[0] == b[j] && a[1] == b[(j + 1) % 3] && a[2] == b[(j + 2) % 3])
+			return 1;
+		if (a[0] == b[j] && a[1] == b[(j + 2) % 3] && a[2] == b[(j + 1) % 3])
+			return -1;
+	}
+
+	return 0;
+}
+
+// Stream the faces of an SMF file, summing their quadrics into the clusters of their corners and
+// keeping each triangle between three clusters once
+// A repeated triangle only adds to the winding of its first copy, +1 in the orientation of that
+// copy and -1 in the other one. The copy is kept if its winding is positive, flipped if it is
+// negative and dropped if it is zero, as buildFromClusteredTriangles would. Returns false if more
+// than maxFaces triangles are found, and sets isValid to false on a vertex index out of range.
+static bool collectClusteredFaces (string filename, const vector<vec3> &positions, const vector<int> &clusterOf, size_t maxFaces, vector<Quadric> &clusterQuadrics, vector<int> &indices, bool &isValid, bool &isReadable) {
+	int numVertices = positions.size() - 1;
+	EdgeHash<int> triangles;
+	vector<int> windings;
+	bool fits = true;
+
+	indices.clear();
+	isValid = true;
+
+	// A grid that does not fit is dropped, so the rest of the file is not read
+	isReadable = streamSmfFile(filename, [&] (const vector<vec3> &, const vector<int> &blockIndices) {
+		for (size_t i = 0; i + 2 < blockIndices.size() && fits; i += 3) {
+			const int *vertices = &blockIndices[i];
+
+			if (vertices[0] < 1 || vertices[0] > numVertices || vertices[1] < 1 || vertices[1] > numVertices || vertices[2] < 1 || vertices[2] > numVertices) {
+				isValid = false;
+				continue;
+			}
+
+			vec3 p1 = positions[vertices[0]], p2 = positions[vertices[1]], p3 = positions[vertices[2]];
+			vec3 faceNormal = getFaceNormalVector(p1, p2, p3);
+			Quadric quadric(vec4(faceNormal, -dot(faceNormal, p1)));
+
+			int corners[3] = {clusterOf[vertices[0]], clusterOf[vertices[1]], clusterOf[vertices[2]]};
+			for (int j = 0; j < 3; j++)
+				clusterQuadrics[corners[j]] += quadric;
+
+			if (corners[0] == corners[1] || corners[1] == corners[2] || corners[2] == corners[0])
+				continue;
+
+			uint64_t key = getTriangleKey(corners);
+			int *face = triangles.find(key);
+			int winding = (face != NULL) ? compareTriangles(corners, &indices[3 * *face]) : 0;
+
+			if (winding != 0) {
+				windings[*face] += winding;
+			} else if (windings.size() < maxFaces) {
+				// A triangle whose key is taken by another one is kept without looking for its copies
+				if (face == NULL)
+					triangles.insert(key, windings.size());
+
+				indices.insert(indices.end(), corners, corners + 3);
+				windings.push_back(1);
+			} else {
+				fits = false;
+			}
+		}
+
+		return fits;
+	});
+
+	if (!fits || !isReadable || !isValid)
+		return fits;
+
+	// Apply the windings
+	size_t numKept = 0;
+	for (size_t f = 0; f < windings.size(); f++) {
+		if (windings[f] == 0)
+			continue;
+
+		int *corners = &indices[3 * numKept];
+		std::copy(&indices[3 * f], &indices[3 * f + 3], corners);
+		if (windings[f] < 0)
+			std::swap(corners[1], corners[2]);
+		numKept++;
+	}
+
+	indices.resize(3 * numKept);
+	return true;
+}
+
+// Decimate an SMF file by vertex clustering, without ever holding it as a mesh
+// The file is streamed twice: the first pass keeps the vertex positions, and stops as soon as they
+// outgrow the budget; the second adds the quadric of each face to the clusters of its corners and
+// keeps the faces that join three clusters. Besides 16 bytes per input vertex, memory goes to the
+// clusters and the decimated mesh, so gridSize is lowered until their estimated size fits in
+// memoryBudget megabytes, and is set to the size used; a grid that does not fit stops the second
+// pass early. Returns the decimated mesh, or NULL if the file cannot be read, has no vertices or
+// the budget does not hold the vertices, or the clusters and faces of a single cell.
+Mesh *decimateSmfFileOutOfCore (string filename, int &gridSize, size_t memoryBudget) {
+	size_t budget = memoryBudget << 20;
+
+	// First pass: vertex positions, read only while they fit
+	size_t streamBytes = 4 * SMF_STREAM_BLOCK_SIZE;
+	size_t maxVertices = (budget > streamBytes) ? (budget - streamBytes) / BYTES_PER_VERTEX : 0;
+
+	vector<vec3> positions(1);
+	vec3 minimum(INFINITY), maximum(-INFINITY);
+	bool fits = true;
+
+	bool isReadable = streamSmfFile(filename, [&] (const vector<vec3> &blockPositions, const vector<int> &) -> bool {
+		size_t numVertices = positions.size() + blockPositions.size() - 1;
+
+		if (numVertices + 1 >= maxVertices) {
+			fits = false;
+			return false;
+		}
+
+		// Grow by a quarter rather than doubling, as the positions take most of the budget
+		if (numVertices >= positions.capacity())
+			positions.reserve(std::min(numVertices + numVertices / 4, maxVertices));
+
+		for (size_t i = 0; i < blockPositions.size(); i++) {
+			minimum = glm::min(minimum, blockPositions[i]);
+			maximum = glm::max(maximum, blockPositions[i]);
+			positions.push_back(blockPositions[i]);
+		}
+
+		return true;
+	});
+
+	if (!isReadable) {
+		cerr << "Error reading file." << endl;
+		return NULL;
+	}
+
+	int numVertices = positions.size() - 1;
+	size_t vertexBytes = (size_t) (numVertices + 1) * BYTES_PER_VERTEX + streamBytes;
+
+	if (!fits) {
+		cerr << "Memory budget too small, the vertices do not fit in " << memoryBudget << " MB." << endl;
+		return NULL;
+	}
+
+	if (numVertices == 0) {
+		cerr << "No vertices in file." << endl;
+		return NULL;
+	}
+
+	size_t maxClusters = std::min((budget - vertexBytes) / (BYTES_PER_CLUSTER + FACES_PER_CLUSTER * BYTES_PER_FACE), budget / BYTES_PER_OUTPUT_VERTEX);
+
+	// Coarsen the grid until the occupied cells and the faces between them fit in the budget
+	vector<int> clusterOf;
+	vector<uint64_t> clusterCell;
+	vector<Quadric> clusterQuadrics;
+	vector<int> indices;
+
+	while (true) {
+		ClusterGrid grid(minimum, maximum, gridSize);
+		gridSize = grid.size;
+
+		fits = assignClusters(positions, grid, maxClusters, clusterOf, clusterCell);
+
+		if (fits) {
+			bool isValid;
+			clusterQuadrics.assign(clusterCell.size(), Quadric());
+			fits = collectClusteredFaces(filename, positions, clusterOf, FACES_PER_CLUSTER * maxClusters, clusterQuadrics, indices, isValid, isReadable);
+
+			if (!isReadable || !isValid) {
+				cerr << (isReadable ? "Invalid vertex index in file." : "Error reading file.") << endl;
+				return NULL;
+			}
+		}
+
+		if (fits || gridSize == 1)
+			break;
+
+		gridSize = gridSize * 3 / 4;
+	}
+
+	// What was collected for a grid that did not fit is incomplete
+	if (!fits) {
+		cerr << "Memory budget too small, the clusters do not fit in " << memoryBudget << " MB." << endl;
+		return NULL;
+	}
+
+	int numClusters = clusterCell.size() - 1;
+
+	// Place the clusters and release the input vertices before the mesh is built
+	vector<vec3> clusterPositions(numClusters + 1, vec3(0.0));
+	vector<int> clusterSizes(numClusters + 1, 0);
+
+	for (int v = 1; v <= numVertices; v++) {
+		clusterPositions[clusterOf[v]] = clusterPositions[clusterOf[v]] + positions[v];
+		clusterSizes[clusterOf[v]]++;
+	}
+
+	vector<vec3>().swap(positions);
+	vector<int>().swap(clusterOf);
+
+	ClusterGrid grid(minimum, maximum, gridSize);
+
+	for (int c = 1; c <= numClusters; c++) {
+		clusterPositions[c] = grid.getClusterPosition(clusterCell[c], clusterQuadrics[c], clusterPositions[c] / (float) clusterSizes[c]);
+	}
+
+	vector<Quadric>().swap(clusterQuadrics);
+
+	Mesh *mesh = new Mesh();
+	mesh->buildFromClusteredTriangles(clusterPositions, indices);
+
+	return mesh;
+}
@@ -0,0 +1,159 @@
+#include <progressive_mesh.h>
+#include <smf_parser.h>
+
+// Key of the directed edge from v1 to v2, never zero as vertex indices start at 1
+static inline uint64_t getHalfEdgeKey (int v1, int v2) {
+	return ((uint64_t) v1 << 32) | (uint32_t) v2;
+}
+
+// Open a progressive mesh file and read its base mesh
+// Returns false if the file cannot be read or a face of the base mesh is invalid.
+bool ProgressiveMeshReader::open (string filename) {
+	file.open(filename.c_str(), std::ios::binary);
+	if (file.fail())
+		return false;
+
+	positions.assign(1, vec3(0.0));
+	indices.clear();
+	numSplits = 0;
+	hasLine = false;
+
+	// The base mesh ends at the first vertex split
+	int vertices[3];
+	vec3 position, newPosition;
+
+	while (std::getline(file, line)) {
+		const char *begin = line.data();
+		const char *end = begin + line.size();
+
+		if (parseVertexSplitRecord(begin, end, vertices, position, newPosition)) {
+			hasLine = true;
+			break;
+		}
+
+		parseSmfRecords(begin, end, positions, indices);
+	}
+
+	int numVertices = positions.size() - 1;
+	int numFaces = indices.size() / 3;
+
+	halfEdges.clear();
+	halfEdges.reserve(3 * numFaces);
+
+	for (int f = 0; f < numFaces; f++) {
+		const int *corners = &indices[3 * f];
+
+		for (int j = 0; j < 3; j++) {
+			if (corners[j] < 1 || corners[j] > numVertices)
+				return false;
+			halfEdges.insert(getHalfEdgeKey(corners[j], corners[(j + 1) % 3]), f);
+		}
+	}
+
+	return true;
+}
+
+// Apply up to maxSplits more vertex splits, returning how many were applied
+// Stops at the end of the file or at the first invalid split.
+int ProgressiveMeshReader::readSplits (int maxSplits) {
+	int count = 0;
+
+	while (count < maxSplits && (hasLine || std::getline(file, line))) {
+		hasLine = false;
+
+		int vertices[3];
+		vec3 position, newPosition;
+
+		if (!parseVertexSplitRecord(line.data(), line.data() + line.size(), vertices, position, newPosition))
+			continue;
+
+		if (!splitVertex(vertices[0], vertices[1], vertices[2], position, newPosition)) {
+			cerr << "Invalid vertex split " << numSplits + 1 << "." << endl;
+			file.setstate(std::ios::eofbit);
+			break;
+		}
+
+		numSplits++;
+		count++;
+	}
+
+	return count;
+}
+
+// Split a vertex in two, undoing the edge collapse that merged them
+// The vertex moves to position and a new vertex appears at newPosition. Going round the vertex,
+// the faces from the one after left up to the one before right move to the new vertex, and the
+// two faces of the restored edge are added. Returns false, changing nothing, if left and right do
+// not bound such a fan.
+bool ProgressiveMeshReader::splitVertex (int vertex, int left, int right, vec3 position, vec3 newPosition) {
+	int numVertices = positions.size() - 1;
+	if (vertex < 1 || vertex > numVertices || left < 1 || left > numVertices || right < 1 || right > numVertices || left == right)
+		return false;
+
+	int numFaces = indices.size() / 3;
+
+	// Each face of the fan holds the directed edges other -> vertex -> next
+	fan.clear();
+	for (int other = left; other != right; ) {
+		int *face = halfEdges.find(getHalfEdgeKey(other, vertex));
+		if (face == NULL || (int) fan.size() == numFaces)
+			return false;
+
+		int *corners = &indices[3 * *face];
+		int j = (corners[0] == vertex) ? 0 : (corners[1] == vertex) ? 1 : 2;
+
+		fan.push_back(3 * *face + j);
+		other = corners[(j + 1) % 3];
+	}
+
+	if (fan.empty())
+		return false;
+
+	int newVertex = numVertices + 1;
+	positions[vertex] = position;
+	positions.push_back(newPosition);
+
+	for (size_t i = 0; i < fan.size(); i++) {
+		int corner = fan[i];
+		int face = corner / 3;
+		int previous = indices[face * 3 + (corner + 2) % 3];
+		int next = indices[face * 3 + (corner + 1) % 3];
+
+		halfEdges.erase(getHalfEdgeKey(previous, vertex));
+		halfEdges.erase(getHalfEdgeKey(vertex, next));
+		indices[corner] = newVertex;
+		halfEdges.insert(getHalfEdgeKey(previous, newVertex), face);
+		halfEdges.insert(getHalfEdgeKey(newVertex, next), face);
+	}
+
+	const int newFaces[6] = {vertex, newVertex, left, newVertex, vertex, right};
+	for (int k = 0; k < 2; k++) {
+		const int *corners = &newFaces[3 * k];
+		for (int j = 0; j < 3; j++)
+			halfEdges.insert(getHalfEdgeKey(corners[j], corners[(j + 1) % 3]), numFaces + k);
+		indices.insert(indices.end(), corners, corners + 3);
+	}
+
+	return true;
+}
+
+// Build a mesh from the base mesh and the splits read so far
+Mesh *ProgressiveMeshReader::getMesh () {
+	Mesh *mesh = new Mesh();
+	mesh->buildFromIndexedTriangles(positions, indices);
+	return mesh;
+}
+
+// Read a progressive mesh file, applying at most maxSplits vertex splits to its base mesh
+// Returns NULL if the file cannot be read.
+Mesh *parseProgressiveMeshFile (string filename, int maxSplits) {
+	ProgressiveMeshReader reader;
+
+	if (!reader.open(filename)) {
+		cerr << "Error reading file." << endl;
+		return NULL;
+	}
+
+	reader.readSplits(maxSplits);
+	return reader.getMesh();
+}
@@ -1,71 +1,656 @@
 #include <smf_parser.h>
+#include <mesh_cache.h>
+#include <parallel.h>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <cmath>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// Powers of ten that are exact in double precision
+static const double exactPowersOfTen[] = {
+	1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+	1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+// Convert mantissa * 10^exponent to the nearest float
+// Exact when the mantissa fits in 53 bits and the power of ten is exact in double precision, as
+// the double is then correctly rounded; returns false otherwise, or if the double lies exactly
+// halfway between two floats, where rounding twice could differ from rounding once.
+static inline bool decimalToFloat (uint64_t mantissa, int exponent, float &value) {
+	if (mantissa > (1ULL << 53) || exponent < -22 || exponent > 22)
+		return false;
+
+	double d = (double) mantissa;
+	if (exponent < 0)
+		d /= exactPowersOfTen[-exponent];
+	else
+		d *= exactPowersOfTen[exponent];
+
+	float f = (float) d;
+
+	if ((double) f != d) {
+		float neighbour = nextafterf(f, d > f ? INFINITY : -INFINITY);
+		if (((double) f + (double) neighbour) / 2 == d)
+			return false;
+	}
+
+	value = f;
+	return true;
+}
+
+// Skip spaces and tabs
+static inline const char *skipSpaces (const char *p, const char *end) {
+	while (p < end && (*p == ' ' || *p == '\t' || *p == '\r'))
+		p++;
+	return p;
+}
+
+// Skip past the end of the current line
+static inline const char *skipLine (const char *p, const char *end) {
+	const char *newline = (const char *) memchr(p, '\n', end - p);
+	return newline ? newline + 1 : end;
+}
+
+// Parse an integer, returning the position after it
+static inline const char *parseInt (const char *p, const char *end, int &value) {
+	p = skipSpaces(p, end);
+
+	bool negative = false;
+	if (p < end && (*p == '-' || *p == '+')) {
+		negative = (*p == '-');
+		p++;
+	}
+
+	int result = 0;
+	while (p < end && *p >= '0' && *p <= '9') {
+		result = result * 10 + (*p - '0');
+		p++;
+	}
+
+	value = negative ? -result : result;
+	return p;
+}
+
+// Parse a float, correctly rounded, returning the position after it
+// Short decimals are converted by decimalToFloat, anything else goes through strtof.
+static const char *parseFloat (const char *p, const char *end, float &value) {
+	p = skipSpaces(p, end);
+	const char *start = p;
+
+	bool negative = false;
+	if (p < end && (*p == '-' || *p == '+')) {
+		negative = (*p == '-');
+		p++;
+	}
+
+	uint64_t mantissa = 0;
+	int digits = 0, exponent = 0;
+	bool anyDigits = false;
+
+	while (p < end && *p >= '0' && *p <= '9') {
+		if (digits < 19) {
+			mantissa = mantissa * 10 + (*p - '0');
+			if (mantissa != 0)
+				digits++;
+		} else {
+			exponent++;
+			digits++;
+		}
+		anyDigits = true;
+		p++;
+	}
+
+	if (p < end && *p == '.') {
+		p++;
+		while (p < end && *p >= '0' && *p <= '9') {
+			if (digits < 19) {
+				mantissa = mantissa * 10 + (*p - '0');
+				if (mantissa != 0)
+					digits++;
+				exponent--;
+			} else {
+				digits++;
+			}
+			anyDigits = true;
+			p++;
+		}
+	}
+
+	if (anyDigits && p < end && (*p == 'e' || *p == 'E')) {
+		int exponentPart;
+		p = parseInt(p + 1, end, exponentPart);
+		exponent += exponentPart;
+	}
+
+	float f;
+	if (anyDigits && digits <= 19 && decimalToFloat(mantissa, exponent, f)) {
+		value = negative ? -f : f;
+		return p;
+	}
+
+	// Slow path, also handles inf and nan
+	char token[128];
+	const char *tokenEnd = start;
+	while (tokenEnd < end && tokenEnd - start < 127 && *tokenEnd != ' ' && *tokenEnd != '\t' && *tokenEnd != '\r' && *tokenEnd != '\n')
+		tokenEnd++;
+
+	memcpy(token, start, tokenEnd - start);
+	token[tokenEnd - start] = '\0';
+	value = strtof(token, NULL);
+
+	return tokenEnd;
+}
+
+// Read the vertex and face counts from the comments at the top of the file
+// Both the "# <vertices> <faces>" first line and the "#$vertices" / "#$faces" hints are recognized
+void readSmfHeader (const char *p, const char *end, int &numVertices, int &numFaces) {
+	numVertices = numFaces = 0;
+	bool firstLine = true;
+
+	while (p < end) {
+		p = skipSpaces(p, end);
+		if (p == end || *p != '#')
+			break;
+
+		const char *lineEnd = (const char *) memchr(p, '\n', end - p);
+		if (lineEnd == NULL)
+			lineEnd = end;
+
+		if (lineEnd - p > 10 && strncmp(p, "#$vertices", 10) == 0) {
+			parseInt(p + 10, lineEnd, numVertices);
+		} else if (lineEnd - p > 7 && strncmp(p, "#$faces", 7) == 0) {
+			parseInt(p + 7, lineEnd, numFaces);
+		} else if (firstLine) {
+			const char *q = skipSpaces(p + 1, lineEnd);
+			if (q < lineEnd && *q >= '0' && *q <= '9') {
+				q = parseInt(q, lineEnd, numVertices);
+				parseInt(q, lineEnd, numFaces);
+			}
+		}
+
+		firstLine = false;
+		p = skipLine(p, end);
+	}
+}
+
+// Parse the vertex and face records of [p, end) onto positions and indices
+void parseSmfRecords (const char *p, const char *end, vector<vec3> &positions, vector<int> &indices) {
+	while (p < end) {
+		p = skipSpaces(p, end);
+		if (p == end)
+			break;
+
+		if (p + 1 < end && (p[1] == ' ' || p[1] == '\t')) {
+			if (*p == 'v') {
+				float x, y, z;
+				p = parseFloat(p + 1, end, x);
+				p = parseFloat(p, end, y);
+				p = parseFloat(p, end, z);
+				positions.push_back(vec3(x, y, z));
+			} else if (*p == 'f') {
+				int v1, v2, v3;
+				p = parseInt(p + 1, end, v1);
+				p = parseInt(p, end, v2);
+				p = parseInt(p, end, v3);
+				indices.push_back(v1);
+				indices.push_back(v2);
+				indices.push_back(v3);
+			}
+		}
+
+		// Ignore comments starting with '#', other records and the rest of the line
+		p = skipLine(p, end);
+	}
+}
+
+// Parse the records of [p, end) on all threads
+// The range is cut into chunks at line boundaries, each chunk is parsed into its own buffers,
+// and prefix sums over the chunk sizes place the buffers in file order, so the vertex numbering
+// and the faces come out exactly as in a sequential scan.
+void parseSmfRecordsParallel (const char *p, const char *end, vector<vec3> &positions, vector<int> &indices) {
+	const size_t minChunkSize = 1 << 20;
+
+	size_t size = end - p;
+	int numThreads = omp_get_max_threads();
+	int numChunks = std::min((size_t) numThreads * 4, size / minChunkSize + 1);
+
+	// A single thread gains nothing from the extra copy
+	if (numThreads == 1 || numChunks == 1) {
+		parseSmfRecords(p, end, positions, indices);
+		return;
+	}
+
+	// Move every cut forward to just past a newline, so no line is split between chunks
+	vector<const char *> cuts(numChunks + 1);
+	cuts[0] = p;
+	cuts[numChunks] = end;
+
+	for (int i = 1; i < numChunks; i++) {
+		const char *cut = std::max(p + size * i / numChunks, cuts[i - 1]);
+		const char *newline = (const char *) memchr(cut, '\n', end - cut);
+		cuts[i] = newline ? newline + 1 : end;
+	}
+
+	vector< vector<vec3> > chunkPositions(numChunks);
+	vector< vector<int> > chunkIndices(numChunks);
+
+	#pragma omp parallel for schedule(dynamic, 1)
+	for (int i = 0; i < numChunks; i++) {
+		parseSmfRecords(cuts[i], cuts[i + 1], chunkPositions[i], chunkIndices[i]);
+	}
+
+	vector<size_t> positionOffsets(numChunks + 1, 0), indexOffsets(numChunks + 1, 0);
+	for (int i = 0; i < numChunks; i++) {
+		positionOffsets[i + 1] = chunkPositions[i].size();
+		indexOffsets[i + 1] = chunkIndices[i].size();
+	}
+
+	parallelPrefixSum(&positionOffsets[0], numChunks + 1);
+	parallelPrefixSum(&indexOffsets[0], numChunks + 1);
+
+	size_t firstPosition = positions.size(), firstIndex = indices.size();
+	positions.resize(firstPosition + positionOffsets[numChunks]);
+	indices.resize(firstIndex + indexOffsets[numChunks]);
+
+	#pragma omp parallel for schedule(dynamic, 1)
+	for (int i = 0; i < numChunks; i++) {
+		std::copy(chunkPositions[i].begin(), chunkPositions[i].end(), positions.begin() + firstPosition + positionOffsets[i]);
+		std::copy(chunkIndices[i].begin(), chunkIndices[i].end(), indices.begin() + firstIndex + indexOffsets[i]);
+		vector<vec3>().swap(chunkPositions[i]);
+		vector<int>().swap(chunkIndices[i]);
+	}
+}
+
+// Read the vertex positions and face corners of an SMF file
+// The file is memory mapped and scanned in place by all threads. Returns false, after printing
+// why, if the file cannot be read.
+static bool readSmfRecords (string filename, vector<vec3> &positions, vector<int> &indices) {
+	int fd = open(filename.c_str(), O_RDONLY);
+	struct stat fileStat;
+
+	if (fd < 0 || fstat(fd, &fileStat) != 0) {
+		cerr << "Error opening file." << endl;
+		if (fd >= 0)
+			close(fd);
+		return false;
+	}
+
+	size_t size = fileStat.st_size;
+	const char *data = "";
+
+	if (size > 0) {
+		data = (const char *) mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+		if (data == MAP_FAILED) {
+			cerr << "Error reading file." << endl;
+			close(fd);
+			return false;
+		}
+
+		madvise((void *) data, size, MADV_SEQUENTIAL);
+	}
+
+	int numVertices, numFaces;
+	readSmfHeader(data, data + size, numVertices, numFaces); // Read the header comments for number of vertices and faces
+
+	positions.assign(1, vec3(0.0));
+	indices.clear();
+	positions.reserve(numVertices + 1);
+	indices.reserve(3 * numFaces);
+
+	parseSmfRecordsParallel(data, data + size, positions, indices);
+
+	if (size > 0)
+		munmap((void *) data, size);
+	close(fd);
+
+	return true;
+}
 
 // Read SMF file and parse data
-Mesh *parseSmfFile (string filename) {
-	ifstream smf_file;
-	smf_file.open(filename.c_str());
+// With useCache, an up to date binary cache next to the file is loaded instead, and a new cache
+// is written after parsing when there is none. Without hasQuadrics the vertices keep no quadrics,
+// for meshes that are only viewed or decimated by memoryless collapses.
+Mesh *parseSmfFile (string filename, bool useCache, bool hasQuadrics) {
+	string cacheFilename = getMeshCacheFilename(filename);
 
-	if (smf_file.fail()) {
-		cerr << "Error opening file." << endl << "Exiting..." << endl;
+	if (useCache) {
+		Mesh *mesh = readMeshCache(cacheFilename, filename, hasQuadrics);
+		if (mesh != NULL)
+			return mesh;
+	}
+
+	vector<vec3> positions;
+	vector<int> indices;
+
+	if (!readSmfRecords(filename, positions, indices)) {
+		cerr << "Exiting..." << endl;
 		exit(1);
 	}
 
-	char type;
-	int numVertices, numFaces;
+	Mesh *mesh = new Mesh(); // Initialize Mesh
+	mesh->hasQuadrics = hasQuadrics;
+	mesh->reserve(positions.size() - 1, indices.size() / 2, indices.size() / 3);
+	mesh->buildFromIndexedTriangles(positions, indices);
 
-	smf_file >> type >> numVertices >> numFaces; // Read first line for number of vertices and faces
+	// The cache only saves time, so failing to write it (e.g. a read-only directory) is not an error
+	if (useCache)
+		writeMeshCache(mesh, cacheFilename, filename);
 
-	Mesh *mesh = new Mesh(numVertices, numFaces); // Initialize Mesh
+	return mesh;
+}
 
-	// Read remaining data
-	while (smf_file >> type) {
-		string line;
-		float x, y, z;
-		int v1, v2, v3;
+// Read only the vertex positions of an SMF file, for a new pose of a mesh whose faces are known
+// positions[0] is unused, as in a mesh. Returns false if the file cannot be read.
+bool readSmfPositions (string filename, vector<vec3> &positions) {
+	vector<int> indices;
+	return readSmfRecords(filename, positions, indices);
+}
 
-		switch (type) {
-			case '#':
-				getline(smf_file, line); // Ignore comments starting with '#'
-				break;
-			case 'v':
-				smf_file >> x >> y >> z;
-				mesh->insertVertex(x, y, z);
-				break;
-			case 'f':
-				smf_file >> v1 >> v2 >> v3;
-				mesh->insertTriangle(v1, v2, v3);
+// Write an integer, returning the end of the written characters
+static inline char *formatInt (char *out, int value) {
+	unsigned int v = value;
+	if (value < 0) {
+		*out++ = '-';
+		v = -v;
+	}
+
+	char digits[10];
+	int n = 0;
+	do {
+		digits[n++] = '0' + v % 10;
+		v /= 10;
+	} while (v != 0);
+
+	while (n > 0)
+		*out++ = digits[--n];
+
+	return out;
+}
+
+// Round a positive float to the given number of significant digits, as mantissa * 10^exponent
+// exponent10 is the decimal exponent of the leading digit, between -14 and 22 so that the
+// scaling uses an exact power of ten.
+static inline void roundToDigits (float value, int exponent10, int precision, uint64_t &mantissa, int &exponent) {
+	int scale = precision - 1 - exponent10;
+
+	double scaled = value;
+	if (scale < 0)
+		scaled /= exactPowersOfTen[-scale];
+	else
+		scaled *= exactPowersOfTen[scale];
+
+	mantissa = (uint64_t) llround(scaled);
+	exponent = -scale;
+}
+
+// Write a float with the fewest significant digits that read back as the same float
+// Returns the end of the written characters, at most 16 are written
+static char *formatFloat (char *out, float value) {
+	if (!std::isfinite(value) || value == 0)
+		return out + sprintf(out, "%g", value);
+
+	if (value < 0) {
+		*out++ = '-';
+		value = -value;
+	}
+
+	// Reading back is exact, and if n digits read back as the value so do n + 1 digits,
+	// so the shortest precision is found by a binary search over 1 to 9 digits
+	int exponent10 = (int) floor(log10((double) value));
+	uint64_t mantissa = 0;
+	int exponent = 0;
+
+	if (exponent10 >= -14 && exponent10 <= 22) {
+		int low = 1, high = 9;
+
+		while (low <= high) {
+			int precision = (low + high) / 2;
+			uint64_t m;
+			int e;
+			float f;
+
+			roundToDigits(value, exponent10, precision, m, e);
+
+			if (decimalToFloat(m, e, f) && f == value) {
+				mantissa = m;
+				exponent = e;
+				high = precision - 1;
+			} else {
+				low = precision + 1;
+			}
+		}
+	}
+
+	// Very large or small values go through sprintf and strtof, nine digits always read back
+	if (mantissa == 0) {
+		int length = 0;
+		for (int precision = 1; precision <= 9; precision++) {
+			length = sprintf(out, "%.*g", precision, value);
+			if (strtof(out, NULL) == value)
 				break;
 		}
+		return out + length;
 	}
 
-	smf_file.close();
+	// Digits of the mantissa, without trailing zeros
+	char digits[20];
+	int n = 0;
+	while (mantissa % 10 == 0) {
+		mantissa /= 10;
+		exponent++;
+	}
+	for (uint64_t m = mantissa; m != 0; m /= 10)
+		digits[n++] = '0' + m % 10;
+	std::reverse(digits, digits + n);
 
-	return mesh;
+	// Decimal exponent of the leading digit
+	int leading = n - 1 + exponent;
+
+	if (leading >= -5 && leading < 0) {
+		*out++ = '0';
+		*out++ = '.';
+		for (int i = -1; i > leading; i--)
+			*out++ = '0';
+		memcpy(out, digits, n);
+		out += n;
+	} else if (leading >= 0 && leading < 9) {
+		for (int i = 0; i < n || i <= leading; i++) {
+			if (i == leading + 1)
+				*out++ = '.';
+			*out++ = i < n ? digits[i] : '0';
+		}
+	} else {
+		*out++ = digits[0];
+		if (n > 1) {
+			*out++ = '.';
+			memcpy(out, digits + 1, n - 1);
+			out += n - 1;
+		}
+		*out++ = 'e';
+		*out++ = leading < 0 ? '-' : '+';
+		if (leading < 0)
+			leading = -leading;
+		if (leading < 10)
+			*out++ = '0';
+		out = formatInt(out, leading);
+	}
+
+	return out;
+}
+
+// Format the vertex lines of vertices [begin, end), returning the number of characters written
+static size_t formatVertexLines (Mesh *mesh, int begin, int end, char *buffer) {
+	char *out = buffer;
+
+	for (int i = begin; i < end; i++) {
+		vec3 position = mesh->positions[i];
+		*out++ = 'v';
+		*out++ = ' ';
+		out = formatFloat(out, position.x);
+		*out++ = ' ';
+		out = formatFloat(out, position.y);
+		*out++ = ' ';
+		out = formatFloat(out, position.z);
+		*out++ = '\n';
+	}
+
+	return out - buffer;
 }
 
+// Format the face lines of faces [begin, end), returning the number of characters written
+static size_t formatFaceLines (Mesh *mesh, int begin, int end, char *buffer) {
+	char *out = buffer;
+
+	for (int i = begin; i < end; i++) {
+		int vertices[3];
+		mesh->getAllVerticesForFace(i, vertices);
+		*out++ = 'f';
+		*out++ = ' ';
+		out = formatInt(out, vertices[0]);
+		*out++ = ' ';
+		out = formatInt(out, vertices[1]);
+		*out++ = ' ';
+		out = formatInt(out, vertices[2]);
+		*out++ = '\n';
+	}
+
+	return out - buffer;
+}
+
+// Write the mesh to an SMF file
+// Blocks of lines are formatted in parallel and written in order, one large write per block.
 void writeSmfFile (Mesh *mesh, string filename) {
 	ofstream smf_file;
-	smf_file.open(filename.c_str());
+	smf_file.open(filename.c_str(), std::ios::binary);
 	
 	if (smf_file.fail()) {
 		cerr << "Error opening file." << endl << "Exiting..." << endl;
 		exit(1);
 	}
 
-	smf_file << "# " << mesh->numVertices << " " << mesh->numFaces << endl;
-	
-	for (int i = 1; i <= mesh->numVertices; i++) {
-		Vertex *vertex = mesh->vertexMap[i];
-		vec3 position = vertex->position;
-		smf_file << "v " << position.x << " " << position.y << " " << position.z << endl;
+	smf_file << "# " << mesh->numVertices << " " << mesh->numFaces << "\n";
+
+	const int linesPerBlock = 1 << 15;
+	const int maxLineLength = 64;
+
+	int numVertexBlocks = (mesh->numVertices + linesPerBlock - 1) / linesPerBlock;
+	int numFaceBlocks = (mesh->numFaces + linesPerBlock - 1) / linesPerBlock;
+	int numBlocks = numVertexBlocks + numFaceBlocks;
+
+	// Format a batch of blocks at a time, so memory stays bounded for any mesh size
+	int batchSize = std::min(2 * omp_get_max_threads(), std::max(numBlocks, 1));
+	vector< vector<char> > buffers(batchSize, vector<char>(linesPerBlock * maxLineLength));
+	vector<size_t> lengths(batchSize);
+
+	for (int first = 0; first < numBlocks; first += batchSize) {
+		int last = std::min(first + batchSize, numBlocks);
+
+		#pragma omp parallel for schedule(dynamic, 1)
+		for (int b = first; b < last; b++) {
+			char *buffer = &buffers[b - first][0];
+
+			if (b < numVertexBlocks) {
+				int begin = 1 + b * linesPerBlock;
+				int end = std::min(begin + linesPerBlock, mesh->numVertices + 1);
+				lengths[b - first] = formatVertexLines(mesh, begin, end, buffer);
+			} else {
+				int begin = 1 + (b - numVertexBlocks) * linesPerBlock;
+				int end = std::min(begin + linesPerBlock, mesh->numFaces + 1);
+				lengths[b - first] = formatFaceLines(mesh, begin, end, buffer);
+			}
+		}
+
+		for (int b = first; b < last; b++)
+			smf_file.write(&buffers[b - first][0], lengths[b - first]);
+	}
+
+	smf_file.close();
+}
+
+// Parse a vertex split record "s vs vl vr xs ys zs xt yt zt" from [p, end)
+// Returns false if the line holds another record.
+bool parseVertexSplitRecord (const char *p, const char *end, int vertices[3], vec3 &position, vec3 &newPosition) {
+	p = skipSpaces(p, end);
+	if (p + 1 >= end || p[0] != 's' || (p[1] != ' ' && p[1] != '\t'))
+		return false;
+
+	p++;
+	for (int i = 0; i < 3; i++)
+		p = parseInt(p, end, vertices[i]);
+
+	p = parseFloat(p, end, position.x);
+	p = parseFloat(p, end, position.y);
+	p = parseFloat(p, end, position.z);
+	p = parseFloat(p, end, newPosition.x);
+	p = parseFloat(p, end, newPosition.y);
+	p = parseFloat(p, end, newPosition.z);
+
+	return true;
+}
+
+// Write the mesh as a progressive mesh: the mesh itself as the base, followed by a vertex split
+// record for each recorded edge collapse, the last collapse first
+// Record "s vs vl vr xs ys zs xt yt zt" moves vertex vs to (xs, ys, zs) and adds a new vertex at
+// (xt, yt, zt), numbered after all earlier ones, which takes the faces of vs from vl round to vr.
+// The collapses renumbered vertices as they removed them, so the records are renumbered to the
+// order in which the splits add vertices; any prefix of the file is then a valid mesh.
+void writeProgressiveMeshFile (Mesh *mesh, string filename) {
+	writeSmfFile(mesh, filename);
+
+	ofstream smf_file;
+	smf_file.open(filename.c_str(), std::ios::binary | std::ios::app);
+
+	if (smf_file.fail()) {
+		cerr << "Error opening file." << endl << "Exiting..." << endl;
+		exit(1);
 	}
 
-	for (int i = 1; i <= mesh->numFaces; i++) {
-		Face *face = mesh->faceMap[i];
-		Vertex *vertices[3];
-		mesh->getAllVerticesForFace(face, vertices);
-		smf_file << "f " << mesh->vertexIndexMap[vertices[0]] << " " << mesh->vertexIndexMap[vertices[1]] << " " << mesh->vertexIndexMap[vertices[2]] << endl;
+	const vector<CollapseRecord> &records = mesh->collapseRecords;
+	int numVertices = mesh->numVertices;
+
+	// Number of each vertex slot of the mesh before the collapse being undone
+	vector<int> vertexNumbers(numVertices + records.size() + 1);
+	for (int v = 0; v <= numVertices; v++)
+		vertexNumbers[v] = v;
+
+	const int linesPerBlock = 1 << 12;
+	const int maxLineLength = 8 + 3 * 11 + 6 * 17;
+	vector<char> buffer(linesPerBlock * maxLineLength);
+	char *out = &buffer[0];
+
+	for (int i = records.size() - 1; i >= 0; i--) {
+		const CollapseRecord &record = records[i];
+
+		// The collapse swapped the last vertex into the slot of the removed one
+		numVertices++;
+		vertexNumbers[numVertices] = vertexNumbers[record.removedVertex];
+		vertexNumbers[record.removedVertex] = numVertices;
+
+		*out++ = 's';
+		*out++ = ' ';
+		out = formatInt(out, vertexNumbers[record.vertex]);
+		*out++ = ' ';
+		out = formatInt(out, vertexNumbers[record.left]);
+		*out++ = ' ';
+		out = formatInt(out, vertexNumbers[record.right]);
+
+		const float coordinates[6] = {record.position.x, record.position.y, record.position.z, record.removedPosition.x, record.removedPosition.y, record.removedPosition.z};
+		for (int j = 0; j < 6; j++) {
+			*out++ = ' ';
+			out = formatFloat(out, coordinates[j]);
+		}
+		*out++ = '\n';
+
+		if (out - &buffer[0] > (linesPerBlock - 1) * maxLineLength || i == 0) {
+			smf_file.write(&buffer[0], out - &buffer[0]);
+			out = &buffer[0];
+		}
 	}
-	
+
 	smf_file.close();
-}
\ No newline at end of file
+}
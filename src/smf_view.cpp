@@ -1,10 +1,15 @@
 #include <smf_parser.h>
+#include <out_of_core.h>
+#include <progressive_mesh.h>
+#include <mesh_history.h>
 #include <GL/glut.h>
 #include <GL/glui.h>
 #include <memory>
 #include <stdexcept>
 #include <string>
 #include <array>
+#include <sstream>
+#include <cfloat>
 
 #define WIDTH 1200
 #define HEIGHT 800
@@ -12,12 +17,19 @@
 using std::runtime_error;
 using std::shared_ptr;
 using std::array;
+using std::istringstream;
 
 enum DisplayType {FLAT_SHADED, SMOOTH_SHADED, WIREFRAME, SHADED_WITH_EDGES};
-enum Buttons {ROTATION, OPEN, SAVE, QUIT, SUBDIVIDE, DECIMATE};
+enum Buttons {ROTATION, OPEN, OPEN_OUT_OF_CORE, SAVE, SAVE_PROGRESSIVE, QUIT, SUBDIVIDE, DECIMATE, LOD_CHAIN, UNDO, REDO};
 
 Mesh *mesh;
 
+// Progressive mesh still being read, refined while idle
+ProgressiveMeshReader *progressiveReader = NULL;
+
+// Undo history of the edits to the mesh
+MeshHistory history;
+
 float xy_aspect;
 int last_x, last_y;
 float rotationX = 0.0, rotationY = 0.0;
@@ -28,20 +40,54 @@ int displayType = FLAT_SHADED;
 float scale = 1.0;
 float view_rotate[16] = {1,0,0,0, 0,1,0,0, 0,0,1,0, 0,0,0,1};
 float obj_pos[] = {0.0, 0.0, 0.0};
+int useMeshCache = 1;
+int memoryBudget = DEFAULT_MEMORY_BUDGET;
+int historyBudget = DEFAULT_HISTORY_BUDGET;
 
 // Subdivision
 int subdivisionType = BUTTERFLY;
 int subdivisionLevel = 1;
 
 // Decimation
+int decimationType = MULTIPLE_CHOICE;
+int collapseType = OPTIMAL_COLLAPSE;
 int decimationK = 1;
 int decimationNumber = 1;
+int decimationTargetFaces = 1000;
+float decimationMaxError = 1.0;
+int decimationGridSize = 64;
+string lodLevels = "50% 25% 10% 1%";
+int recordCollapses = 0;
+
+// Stop refining the progressive mesh being read
+void closeProgressiveMesh () {
+	delete progressiveReader;
+	progressiveReader = NULL;
+}
+
+// Read the next vertex splits of the progressive mesh and show the refined mesh
+// Each step reads about half as many splits as there are vertices, so the mesh is rebuilt only a
+// few times on the way to full resolution.
+void refineProgressiveMesh () {
+	int numSplits = std::max(1024, (int) progressiveReader->positions.size() / 2);
+
+	if (progressiveReader->readSplits(numSplits) == 0) {
+		closeProgressiveMesh();
+		return;
+	}
+
+	delete mesh;
+	mesh = progressiveReader->getMesh();
+}
 
 // GLUT idle function
 void glutIdle (void) {
 	if (glutGetWindow() != main_window)
 		glutSetWindow(main_window);
 
+	if (progressiveReader != NULL)
+		refineProgressiveMesh();
+
 	glutPostRedisplay();
 }
 
@@ -59,21 +105,18 @@ void displayFlatShaded (void) {
 	glEnable(GL_NORMALIZE);
 	glBegin(GL_TRIANGLES);
 	
-	Face *f;
-	Vertex *vertices[3];
+	int vertices[3];
 
 	vec3 faceNormal;
 
 	for (int i = 1; i <= mesh->numFaces; i++) {
-		f = mesh->faceMap[i];
-
-		faceNormal = mesh->getFaceNormal(f);
+		faceNormal = mesh->faceNormals[i];
 		glNormal3f(faceNormal.x, faceNormal.y, faceNormal.z);
 
-		mesh->getAllVerticesForFace(f, vertices);
+		mesh->getAllVerticesForFace(i, vertices);
 
 		for (int j = 0; j < 3; j++) {
-			vec3 position = vertices[j]->position;
+			vec3 position = mesh->positions[vertices[j]];
 			glVertex3f(position.x, position.y, position.z);
 		}
 	}
@@ -87,20 +130,17 @@ void displaySmoothShaded (void) {
 	glEnable(GL_NORMALIZE);
 	glBegin(GL_TRIANGLES);
 	
-	Face *f;
-	Vertex *vertices[3];
+	int vertices[3];
 	vec3 vertexNormal;
 
 	for (int i = 1; i <= mesh->numFaces; i++) {
-		f = mesh->faceMap[i];
-
-		mesh->getAllVerticesForFace(f, vertices);
+		mesh->getAllVerticesForFace(i, vertices);
 
 		for (int j = 0; j < 3; j++) {
-			vertexNormal = vertices[j]->normal;
+			vertexNormal = mesh->normals[vertices[j]];
 			glNormal3f(vertexNormal.x, vertexNormal.y, vertexNormal.z);
 
-			vec3 position = vertices[j]->position;
+			vec3 position = mesh->positions[vertices[j]];
 			glVertex3f(position.x, position.y, position.z);
 		}
 	}
@@ -112,21 +152,9 @@ void displaySmoothShaded (void) {
 void displayWireframe (void) {
 	glBegin(GL_LINES);
 
-	W_edge *edge;
-
-	for (map<string, W_edge*>::const_iterator it = mesh->edgeMap.begin(); it != mesh->edgeMap.end(); it++) {
-		edge = it->second;
-
-		if (edge == NULL) {
-			std::cout << "First!!::" << it->first << std::endl;
-			std::cout << "edge:" << edge << std::endl;
-			std::cout << "edge index:" << mesh->edgeIndexMap[edge] << std::endl;
-			std::cout << "edge key:" << mesh->edgeKeyMap[mesh->edgeIndexMap[edge]] << std::endl;
-		}
-		
-
-		vec3 startPosition = edge->start->position;
-		vec3 endPosition = edge->end->position;
+	for (int i = 1; i <= mesh->numEdges; i++) {
+		vec3 startPosition = mesh->positions[mesh->edgeStart[i]];
+		vec3 endPosition = mesh->positions[mesh->edgeEnd[i]];
 
 		glVertex3f(startPosition.x, startPosition.y, startPosition.z);
 		glVertex3f(endPosition.x, endPosition.y, endPosition.z);
@@ -197,21 +225,47 @@ string exec(const char* cmd) {
     return result;
 }
 
-// Initialize mesh
-void initMesh (string smf_filename) {
-	mesh = parseSmfFile(smf_filename);
+// Replace the mesh and center it in the view
+void replaceMesh (Mesh *newMesh) {
+	// Release the replaced mesh
+	delete mesh;
+	mesh = newMesh;
+	history.clear();
+
 	mesh->computeBoundingBox();
 	obj_pos[0] = -(mesh->xMin + mesh->xMax) / 2;
 	obj_pos[1] = -(mesh->yMin + mesh->yMax) / 2;
 	obj_pos[2] = 1.5 * (mesh->zMin - mesh->zMax);
 }
 
+// Initialize mesh
+// A progressive mesh (.pm) shows its base mesh at once and is refined while idle.
+void initMesh (string smf_filename) {
+	closeProgressiveMesh();
+
+	if (smf_filename.size() > 3 && smf_filename.compare(smf_filename.size() - 3, 3, ".pm") == 0) {
+		progressiveReader = new ProgressiveMeshReader();
+		if (!progressiveReader->open(smf_filename)) {
+			cerr << "Error reading file." << endl;
+			closeProgressiveMesh();
+			return;
+		}
+
+		replaceMesh(progressiveReader->getMesh());
+		return;
+	}
+
+	// With memoryless collapses selected, the vertices keep no quadrics and every later decimation of
+	// the mesh is memoryless
+	replaceMesh(parseSmfFile(smf_filename, useMeshCache, collapseType != MEMORYLESS_COLLAPSE));
+}
+
 // GLUI control callback
 void control_cb(int control) {
 	switch (control) {
 		case OPEN: {
 			string inputFilePath;
-			inputFilePath = exec("zenity --file-selection --file-filter='SMF files (smf) | *.smf' --title=\"Select a SMF file\" 2>/dev/null");
+			inputFilePath = exec("zenity --file-selection --file-filter='SMF files (smf, pm) | *.smf *.pm' --title=\"Select a SMF file\" 2>/dev/null");
 			// Remove the newline character at the end
 			inputFilePath = inputFilePath.substr(0, inputFilePath.size() - 1);
 			if (inputFilePath.size() != 0)
@@ -219,6 +273,23 @@ void control_cb(int control) {
 			break;
 		}
 
+		case OPEN_OUT_OF_CORE: {
+			string inputFilePath;
+			inputFilePath = exec("zenity --file-selection --file-filter='SMF files (smf) | *.smf' --title=\"Select a large SMF file\" 2>/dev/null");
+			// Remove the newline character at the end
+			inputFilePath = inputFilePath.substr(0, inputFilePath.size() - 1);
+			if (inputFilePath.size() == 0)
+				break;
+
+			// Decimate while reading, with the clustering grid size lowered to fit the memory budget
+			closeProgressiveMesh();
+			Mesh *newMesh = decimateSmfFileOutOfCore(inputFilePath, decimationGridSize, memoryBudget);
+			if (newMesh != NULL)
+				replaceMesh(newMesh);
+			GLUI_Master.sync_live_all();
+			break;
+		}
+
 		case SAVE: {
 			string saveFilePath;
 			saveFilePath = exec("zenity --file-selection --save --confirm-overwrite --title=\"Save SMF file\" 2>/dev/null");
@@ -228,6 +299,29 @@ void control_cb(int control) {
 				writeSmfFile(mesh, saveFilePath);
 			break;
 		}
+
+		case UNDO:
+			closeProgressiveMesh();
+			history.undo(mesh);
+			break;
+
+		case REDO:
+			closeProgressiveMesh();
+			history.redo(mesh);
+			break;
+
+		case SAVE_PROGRESSIVE: {
+			if (mesh == NULL)
+				break;
+
+			string saveFilePath;
+			saveFilePath = exec("zenity --file-selection --save --confirm-overwrite --file-filter='Progressive meshes (pm) | *.pm' --title=\"Save progressive mesh\" 2>/dev/null");
+			// Remove the newline character at the end
+			saveFilePath = saveFilePath.substr(0, saveFilePath.size() - 1);
+			if (saveFilePath.size() != 0)
+				writeProgressiveMeshFile(mesh, saveFilePath);
+			break;
+		}
 	}
 };
 
@@ -235,14 +329,116 @@ void subdivision_cb (int control) {
 	if (mesh == NULL)
 		return;
 
-	mesh = mesh->subdivideMesh(subdivisionType, subdivisionLevel);
+	closeProgressiveMesh();
+
+	Mesh *subdividedMesh = mesh->subdivideMesh(subdivisionType, subdivisionLevel);
+
+	// Keep the replaced mesh for undo
+	if (subdividedMesh != mesh) {
+		history.maxBytes = (size_t) historyBudget << 20;
+		history.pushMesh(mesh);
+		mesh = subdividedMesh;
+	}
+}
+
+// Set the collapse type of the next decimation, and record its edge collapses if asked to, for
+// progressive meshes, and their inverses for undo if recordInverses is set
+void setupDecimation (bool recordInverses) {
+	closeProgressiveMesh();
+
+	mesh->collapseType = collapseType;
+
+	mesh->recordCollapses = recordCollapses;
+	if (!recordCollapses)
+		mesh->collapseRecords.clear();
+
+	history.maxBytes = (size_t) historyBudget << 20;
+	if (recordInverses)
+		history.beginDecimation(mesh);
 }
 
 void decimation_cb (int control) {
 	if (mesh == NULL)
 		return;
 
-	mesh->decimate(decimationK, decimationNumber);
+	// Clustering rebuilds the mesh and the parallel decimation renumbers it, so undo keeps a copy
+	// instead of the inverses of the collapses
+	bool keepsCopy = (decimationType == CLUSTERING || decimationType == PARALLEL);
+	if (keepsCopy) {
+		history.maxBytes = (size_t) historyBudget << 20;
+		history.pushMesh(new Mesh(*mesh));
+	}
+
+	setupDecimation(!keepsCopy);
+
+	switch (decimationType) {
+		case MULTIPLE_CHOICE:
+			mesh->decimate(decimationK, decimationNumber);
+			break;
+		case GREEDY:
+			mesh->greedyDecimation(decimationTargetFaces, decimationMaxError);
+			break;
+		case PARALLEL:
+			mesh->parallelDecimation(decimationTargetFaces, decimationMaxError);
+			break;
+		case CLUSTERING:
+			mesh->clusterDecimation(decimationGridSize);
+			break;
+	}
+
+	history.endDecimation(mesh);
+}
+
+// Parse levels of detail separated by spaces: a face count ("5000"), a percentage of the faces of
+// the mesh ("25%") or a maximum collapse error ("e0.001")
+vector<LodLevel> parseLodLevels (string text, int numFaces) {
+	vector<LodLevel> levels;
+	istringstream stream(text);
+	string word;
+
+	while (stream >> word) {
+		LodLevel level = {0, FLT_MAX};
+
+		if (word[0] == 'e')
+			level.maxError = atof(word.c_str() + 1);
+		else if (word[word.size() - 1] == '%')
+			level.targetFaces = (int) (numFaces * atof(word.c_str()) / 100.0);
+		else
+			level.targetFaces = atoi(word.c_str());
+
+		levels.push_back(level);
+	}
+
+	return levels;
+}
+
+// Decimate the mesh through the levels of detail, saving each level as <name>_lod<i>.smf
+void lod_chain_cb (int control) {
+	if (mesh == NULL)
+		return;
+
+	closeProgressiveMesh();
+
+	vector<LodLevel> levels = parseLodLevels(lodLevels, mesh->numFaces);
+	if (levels.empty())
+		return;
+
+	string saveFilePath;
+	saveFilePath = exec("zenity --file-selection --save --title=\"Save levels of detail\" 2>/dev/null");
+	// Remove the newline character at the end
+	saveFilePath = saveFilePath.substr(0, saveFilePath.size() - 1);
+	if (saveFilePath.size() == 0)
+		return;
+
+	if (saveFilePath.size() > 4 && saveFilePath.compare(saveFilePath.size() - 4, 4, ".smf") == 0)
+		saveFilePath.resize(saveFilePath.size() - 4);
+
+	setupDecimation(true);
+	mesh->decimateToLevels(levels, [&] (int level) {
+		writeSmfFile(mesh, saveFilePath + "_lod" + to_string(level) + ".smf");
+	});
+
+	history.endDecimation(mesh);
 }
 
 // Setup GLUI
@@ -281,6 +477,19 @@ void setupGlui () {
   	glui->add_button_to_panel(subdivisionPanel, "subdivide", SUBDIVIDE, subdivision_cb);
 
   	// Decimation
+	GLUI_Listbox *decimationListbox = new GLUI_Listbox(decimationPanel, "Type:", &decimationType);
+	decimationListbox->add_item(MULTIPLE_CHOICE, "Multiple Choice");
+	decimationListbox->add_item(GREEDY, "Greedy");
+	decimationListbox->add_item(PARALLEL, "Parallel");
+	decimationListbox->add_item(CLUSTERING, "Clustering");
+	decimationListbox->set_alignment(GLUI_ALIGN_RIGHT);
+
+	GLUI_Listbox *collapseListbox = new GLUI_Listbox(decimationPanel, "Collapse:", &collapseType);
+	collapseListbox->add_item(OPTIMAL_COLLAPSE, "Optimal");
+	collapseListbox->add_item(HALF_EDGE_COLLAPSE, "Half Edge");
+	collapseListbox->add_item(MEMORYLESS_COLLAPSE, "Memoryless");
+	collapseListbox->set_alignment(GLUI_ALIGN_RIGHT);
+
 	GLUI_Spinner *decimation_k_spinner = new GLUI_Spinner(decimationPanel, "k:", &decimationK);
 	decimation_k_spinner->set_int_limits(1, 20000);
 	decimation_k_spinner->set_alignment(GLUI_ALIGN_RIGHT);
@@ -289,8 +498,27 @@ void setupGlui () {
 	decimation_number_spinner->set_int_limits(1, 20000);
 	decimation_number_spinner->set_alignment(GLUI_ALIGN_RIGHT);
 
+	GLUI_Spinner *decimation_target_spinner = new GLUI_Spinner(decimationPanel, "Target Faces:", &decimationTargetFaces);
+	decimation_target_spinner->set_int_limits(0, 10000000);
+	decimation_target_spinner->set_alignment(GLUI_ALIGN_RIGHT);
+
+	GLUI_Spinner *decimation_error_spinner = new GLUI_Spinner(decimationPanel, "Max Error:", &decimationMaxError);
+	decimation_error_spinner->set_float_limits(0.0f, 1.0f);
+	decimation_error_spinner->set_alignment(GLUI_ALIGN_RIGHT);
+
+	GLUI_Spinner *decimation_grid_spinner = new GLUI_Spinner(decimationPanel, "Grid Size:", &decimationGridSize);
+	decimation_grid_spinner->set_int_limits(1, 4096);
+	decimation_grid_spinner->set_alignment(GLUI_ALIGN_RIGHT);
+
+	new GLUI_Checkbox(decimationPanel, "Record Collapses", &recordCollapses);
+
 	glui->add_button_to_panel(decimationPanel, "decimate", DECIMATE, decimation_cb);
 
+	GLUI_EditText *lod_levels_text = new GLUI_EditText(decimationPanel, "LODs:", lodLevels);
+	lod_levels_text->set_alignment(GLUI_ALIGN_RIGHT);
+
+	glui->add_button_to_panel(decimationPanel, "save LOD chain", LOD_CHAIN, lod_chain_cb);
+
 	// Add Scale Spinner
 	GLUI_Spinner *scale_spinner = new GLUI_Spinner(transformationsPanel, "Scale:", &scale);
   	scale_spinner->set_float_limits(0.2f, 5.0);
@@ -310,7 +538,18 @@ void setupGlui () {
 
 	// Add Buttons
 	glui->add_button_to_panel(controlsPanel, "Open", OPEN, control_cb);
+	new GLUI_Checkbox(controlsPanel, "Binary Cache", &useMeshCache);
+	glui->add_button_to_panel(controlsPanel, "Open Large", OPEN_OUT_OF_CORE, control_cb);
+	GLUI_Spinner *memory_budget_spinner = new GLUI_Spinner(controlsPanel, "Memory (MB):", &memoryBudget);
+	memory_budget_spinner->set_int_limits(16, 65536);
+	memory_budget_spinner->set_alignment(GLUI_ALIGN_RIGHT);
 	glui->add_button_to_panel(controlsPanel, "Save", SAVE, control_cb);
+	glui->add_button_to_panel(controlsPanel, "Save Progressive", SAVE_PROGRESSIVE, control_cb);
+	glui->add_button_to_panel(controlsPanel, "Undo", UNDO, control_cb);
+	glui->add_button_to_panel(controlsPanel, "Redo", REDO, control_cb);
+	GLUI_Spinner *history_budget_spinner = new GLUI_Spinner(controlsPanel, "History (MB):", &historyBudget);
+	history_budget_spinner->set_int_limits(0, 65536);
+	history_budget_spinner->set_alignment(GLUI_ALIGN_RIGHT);
 	glui->add_button_to_panel(controlsPanel, "Quit", QUIT, (GLUI_Update_CB)exit);
 };
 
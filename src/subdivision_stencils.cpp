@@ -0,0 +1,201 @@
+#include <subdivision_stencils.h>
+#include <smf_parser.h>
+#include <parallel.h>
+
+// Compose the stencils of one more subdivision level of mesh with those of its vertices
+// Row v of offsets, sources and weights maps the base mesh to vertex v of mesh. The rows are
+// replaced by those of the vertices of its subdivision: the existing vertices, then one for each
+// edge. Each thread sums the rows of a block in a dense array of the base vertices, in double.
+static void composeStencils (Mesh *mesh, int subdivisionType, int numBaseVertices, vector<int> &offsets, vector<int> &sources, vector<float> &weights) {
+	int numRows = mesh->numVertices + mesh->numEdges;
+	int numBlocks = (numRows + STENCIL_BLOCK_SIZE - 1) / STENCIL_BLOCK_SIZE;
+
+	vector< vector<int> > blockSources(numBlocks);
+	vector< vector<float> > blockWeights(numBlocks);
+	vector<int> newOffsets(numRows + 1, 0);
+
+	#pragma omp parallel
+	{
+		vector<double> sums(numBaseVertices + 1, 0.0);
+		vector<int> stamps(numBaseVertices + 1, 0);
+		vector<int> touched, vertices;
+		vector<float> vertexWeights;
+
+		#pragma omp for schedule(dynamic, 1)
+		for (int b = 0; b < numBlocks; b++) {
+			int begin = 1 + b * STENCIL_BLOCK_SIZE;
+			int end = std::min(begin + STENCIL_BLOCK_SIZE, numRows + 1);
+
+			for (int row = begin; row < end; row++) {
+				vertices.clear();
+				vertexWeights.clear();
+
+				if (row <= mesh->numVertices)
+					mesh->getVertexStencil(subdivisionType, row, vertices, vertexWeights);
+				else
+					mesh->getMidpointStencil(subdivisionType, row - mesh->numVertices, vertices, vertexWeights);
+
+				// Rows are numbered from 1, so a stamp of the row marks the base vertices it has touched
+				touched.clear();
+				for (size_t i = 0; i < vertices.size(); i++) {
+					int v = vertices[i];
+
+					for (int j = offsets[v - 1]; j < offsets[v]; j++) {
+						int source = sources[j];
+
+						if (stamps[source] != row) {
+							stamps[source] = row;
+							sums[source] = 0.0;
+							touched.push_back(source);
+						}
+
+						sums[source] += (double) vertexWeights[i] * weights[j];
+					}
+				}
+
+				std::sort(touched.begin(), touched.end());
+
+				int count = 0;
+				for (size_t i = 0; i < touched.size(); i++) {
+					float weight = sums[touched[i]];
+					if (weight == 0.0f)
+						continue;
+
+					blockSources[b].push_back(touched[i]);
+					blockWeights[b].push_back(weight);
+					count++;
+				}
+
+				newOffsets[row] = count;
+			}
+		}
+	}
+
+	parallelPrefixSum(&newOffsets[0], numRows + 1);
+
+	sources.resize(newOffsets[numRows]);
+	weights.resize(newOffsets[numRows]);
+
+	#pragma omp parallel for schedule(dynamic, 1)
+	for (int b = 0; b < numBlocks; b++) {
+		int first = newOffsets[b * STENCIL_BLOCK_SIZE];
+		std::copy(blockSources[b].begin(), blockSources[b].end(), sources.begin() + first);
+		std::copy(blockWeights[b].begin(), blockWeights[b].end(), weights.begin() + first);
+		vector<int>().swap(blockSources[b]);
+		vector<float>().swap(blockWeights[b]);
+	}
+
+	offsets.swap(newOffsets);
+}
+
+// Compile the stencil table of a subdivision of mesh, one level at a time
+// Returns the subdivided mesh, as subdivideMesh would, whose topology update keeps.
+Mesh *SubdivisionStencilTable::compile (Mesh *mesh, int subdivisionType, int subdivisionLevel) {
+	this->subdivisionType = subdivisionType;
+	this->subdivisionLevel = subdivisionLevel;
+	numBaseVertices = mesh->numVertices;
+
+	// Level 0 maps each base vertex to itself
+	offsets.resize(numBaseVertices + 1);
+	sources.resize(numBaseVertices);
+	weights.assign(numBaseVertices, 1.0f);
+
+	for (int v = 0; v <= numBaseVertices; v++) {
+		offsets[v] = v;
+		if (v > 0)
+			sources[v - 1] = v;
+	}
+
+	Mesh *subdividedMesh = mesh;
+
+	for (int i = 0; i < subdivisionLevel; i++) {
+		composeStencils(subdividedMesh, subdivisionType, numBaseVertices, offsets, sources, weights);
+
+		Mesh *nextMesh = subdividedMesh->subdivideMesh(subdivisionType, 1);
+
+		// Intermediate levels are released as soon as the next one is built
+		if (subdividedMesh != mesh && subdividedMesh != nextMesh)
+			delete subdividedMesh;
+
+		subdividedMesh = nextMesh;
+	}
+
+	numVertices = subdividedMesh->numVertices;
+	numFaces = subdividedMesh->numFaces;
+
+	indices.resize(3 * numFaces);
+
+	#pragma omp parallel for
+	for (int f = 1; f <= numFaces; f++) {
+		subdividedMesh->getAllVerticesForFace(f, &indices[3 * f - 3]);
+	}
+
+	parallelGroupBy(3 * numFaces, numVertices + 1, [&] (int h) { return indices[h]; }, cornerOffsets, corners);
+
+	return subdividedMesh;
+}
+
+// Subdivide a new pose of the base mesh into positions, indexed from 1 as in a mesh
+// Returns false if basePositions does not hold one position for each base vertex.
+bool SubdivisionStencilTable::apply (const vector<vec3> &basePositions, vector<vec3> &positions) const {
+	if ((int) basePositions.size() != numBaseVertices + 1) {
+		cerr << "Expected " << numBaseVertices << " vertices, found " << (int) basePositions.size() - 1 << "." << endl;
+		return false;
+	}
+
+	positions.resize(numVertices + 1);
+	positions[0] = vec3(0.0);
+
+	#pragma omp parallel for schedule(dynamic, STENCIL_BLOCK_SIZE)
+	for (int v = 1; v <= numVertices; v++) {
+		vec3 position(0.0);
+
+		for (int i = offsets[v - 1]; i < offsets[v]; i++) {
+			position += basePositions[sources[i]] * weights[i];
+		}
+
+		positions[v] = position;
+	}
+
+	return true;
+}
+
+// Move the vertices of subdividedMesh, as returned by compile, to the subdivision of a new pose
+// of the base mesh, and sum its face normals and quadrics again over the cached faces
+// Returns false if the pose or the mesh do not match the table.
+bool SubdivisionStencilTable::update (const vector<vec3> &basePositions, Mesh *subdividedMesh) const {
+	Mesh *mesh = subdividedMesh;
+
+	if (mesh->numVertices != numVertices || mesh->numFaces != numFaces) {
+		cerr << "Mesh does not match the stencil table." << endl;
+		return false;
+	}
+
+	if (!apply(basePositions, mesh->positions))
+		return false;
+
+	#pragma omp parallel for
+	for (int f = 1; f <= numFaces; f++) {
+		const int *vertices = &indices[3 * f - 3];
+		mesh->faceNormals[f] = getFaceNormalVector(mesh->positions[vertices[0]], mesh->positions[vertices[1]], mesh->positions[vertices[2]]);
+	}
+
+	#pragma omp parallel for schedule(dynamic, STENCIL_BLOCK_SIZE)
+	for (int v = 1; v <= numVertices; v++) {
+		vec3 normal(0.0);
+		Quadric quadric;
+
+		for (int i = cornerOffsets[v]; i < cornerOffsets[v + 1]; i++) {
+			int f = corners[i] / 3 + 1;
+			normal += mesh->faceNormals[f];
+			if (mesh->hasQuadrics)
+				quadric += mesh->getQuadric(f, v);
+		}
+
+		mesh->normals[v] = normal;
+		if (mesh->hasQuadrics)
+			mesh->quadrics[v] = quadric;
+	}
+
+	return true;
+}
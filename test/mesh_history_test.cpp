@@ -0,0 +1,54 @@
+#include <mesh_history.h>
+#include <smf_parser.h>
+#include <cfloat>
+
+// Report a failed check
+static bool check (bool condition, const char *message) {
+	if (!condition)
+		cerr << "FAILED: " << message << endl;
+	return condition;
+}
+
+// Check that a mesh records no edge collapse inverses outside a decimation
+static bool recordsNothing (Mesh *mesh) {
+	return mesh->collapseInverses.empty() && !mesh->recordInverses;
+}
+
+// Decimate as the viewer does: greedily, then by clustering on a copy kept for undo. Undoing both
+// and redoing both must give the same meshes without any mesh keeping collapse inverses.
+int main (int argc, char **argv) {
+	string filename = (argc > 1) ? argv[1] : "samples/horse.smf";
+	Mesh *mesh = parseSmfFile(filename);
+	MeshHistory history;
+	bool passed = true;
+
+	history.beginDecimation(mesh);
+	mesh->greedyDecimation(mesh->numFaces / 2, FLT_MAX);
+	history.endDecimation(mesh);
+	int greedyFaces = mesh->numFaces;
+
+	// The copy is taken during the decimation, as the viewer did, to check that it is reset
+	history.beginDecimation(mesh);
+	history.pushMesh(new Mesh(*mesh));
+	mesh->clusterDecimation(32);
+	history.endDecimation(mesh);
+	int clusteredFaces = mesh->numFaces;
+
+	passed &= check(history.undo(mesh) && mesh->numFaces == greedyFaces, "undo clustering");
+	passed &= check(recordsNothing(mesh), "no inverses after undoing clustering");
+	passed &= check(history.undo(mesh) && mesh->numFaces > greedyFaces, "undo greedy decimation");
+
+	passed &= check(history.redo(mesh) && mesh->numFaces == greedyFaces, "redo greedy decimation");
+	passed &= check(recordsNothing(mesh), "no inverses after redoing greedy decimation");
+	passed &= check(history.redo(mesh) && mesh->numFaces == clusteredFaces, "redo clustering");
+	passed &= check(recordsNothing(mesh), "no inverses after redoing clustering");
+
+	// Undo the clustering once more, then redo only the greedy decimation on the restored copy
+	passed &= check(history.undo(mesh) && history.undo(mesh) && history.redo(mesh), "undo twice and redo");
+	passed &= check(recordsNothing(mesh), "no inverses on the restored copy");
+
+	delete mesh;
+
+	cout << (passed ? "mesh_history_test passed" : "mesh_history_test failed") << endl;
+	return passed ? 0 : 1;
+}
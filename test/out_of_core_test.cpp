@@ -0,0 +1,129 @@
+#include <out_of_core.h>
+#include <smf_parser.h>
+#include <cstdio>
+#include <fstream>
+#include <sys/resource.h>
+
+// Budget too small for the vertices of the copies, and one that holds them but not the file
+#define SMALL_BUDGET 36
+#define BUDGET 64
+
+// Copies of the model along each side of the grid they are laid out in
+#define COPIES 8
+
+// Report a failed check
+static bool check (bool condition, const char *message) {
+	if (!condition)
+		cerr << "FAILED: " << message << endl;
+	return condition;
+}
+
+// Peak memory of the process, in megabytes
+static size_t getPeakMegabytes () {
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	return usage.ru_maxrss >> 10;
+}
+
+// Write COPIES x COPIES copies of a mesh side by side into an SMF file
+// Returns the size of the file in megabytes, 0 if it cannot be written.
+static size_t writeCopies (Mesh *mesh, string filename) {
+	ofstream file(filename.c_str());
+	if (!file)
+		return 0;
+
+	mesh->computeBoundingBox();
+	float spacing = 1.5f * std::max(mesh->xMax - mesh->xMin, mesh->yMax - mesh->yMin);
+	int numCopies = COPIES * COPIES;
+
+	file << "# " << numCopies * mesh->numVertices << " " << numCopies * mesh->numFaces << "\n";
+
+	for (int i = 0; i < numCopies; i++) {
+		vec3 offset((i % COPIES) * spacing, (i / COPIES) * spacing, 0.0f);
+
+		for (int v = 1; v <= mesh->numVertices; v++) {
+			vec3 p = mesh->positions[v] + offset;
+			file << "v " << p.x << " " << p.y << " " << p.z << "\n";
+		}
+	}
+
+	for (int i = 0; i < numCopies; i++) {
+		int first = i * mesh->numVertices;
+
+		for (int f = 1; f <= mesh->numFaces; f++) {
+			int vertices[3];
+			mesh->getAllVerticesForFace(f, vertices);
+			file << "f " << first + vertices[0] << " " << first + vertices[1] << " " << first + vertices[2] << "\n";
+		}
+	}
+
+	size_t size = file.tellp();
+	return file ? size >> 20 : 0;
+}
+
+// Check that a mesh is a closed manifold: every edge has a face on each side, and the edges around
+// each vertex form a single fan of as many edges as its valence
+static bool isClosedManifold (Mesh *mesh) {
+	if (mesh->numFaces == 0 || 2 * mesh->numEdges != 3 * mesh->numFaces)
+		return false;
+
+	for (int e = 1; e <= mesh->numEdges; e++) {
+		if (mesh->edgeLeft[e] == 0 || mesh->edgeRight[e] == 0 || mesh->edgeLeft[e] == mesh->edgeRight[e])
+			return false;
+	}
+
+	for (int v = 1; v <= mesh->numVertices; v++) {
+		int e1 = mesh->vertexEdge[v];
+		int e = e1;
+		int count = 0;
+
+		if (e1 == 0 || mesh->valences[v] < 3)
+			return false;
+
+		do {
+			e = (mesh->edgeStart[e] == v) ? mesh->edgeLeftPrev[e] : mesh->edgeRightNext[e];
+			count++;
+		} while (e != e1 && count <= mesh->valences[v]);
+
+		if (count != mesh->valences[v])
+			return false;
+	}
+
+	return true;
+}
+
+// Decimate copies of a model that make a file larger than the memory budget, out of core. A budget
+// that cannot hold their vertices must be refused without reading all of them, and the decimated
+// mesh must be a closed manifold built within the budget.
+int main (int argc, char **argv) {
+	string filename = (argc > 1) ? argv[1] : "samples/horse.smf";
+	string copiesFilename = string(argv[0]) + ".smf";
+	bool passed = true;
+
+	Mesh *mesh = parseSmfFile(filename);
+	if (!check(mesh != NULL, "read the model"))
+		return 1;
+
+	size_t fileSize = writeCopies(mesh, copiesFilename);
+	delete mesh;
+
+	if (!check(fileSize > BUDGET, "write copies larger than the budget"))
+		return 1;
+
+	int gridSize = 256;
+	mesh = decimateSmfFileOutOfCore(copiesFilename, gridSize, SMALL_BUDGET);
+	passed &= check(mesh == NULL, "refuse a budget without room for the vertices");
+	passed &= check(getPeakMegabytes() < SMALL_BUDGET, "stay within the refused budget");
+
+	gridSize = 256;
+	mesh = decimateSmfFileOutOfCore(copiesFilename, gridSize, BUDGET);
+	passed &= check(mesh != NULL, "decimate within the budget");
+	passed &= check(mesh != NULL && isClosedManifold(mesh), "closed manifold output");
+	passed &= check(getPeakMegabytes() < BUDGET, "stay within the budget");
+
+	delete mesh;
+	remove(copiesFilename.c_str());
+
+	cout << (passed ? "out_of_core_test passed" : "out_of_core_test failed") << endl;
+	return passed ? 0 : 1;
+}